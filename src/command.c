@@ -120,12 +120,30 @@ Command mk_exit_command() {
   return cmd;
 }
 
+// Create HashCommand structure
+Command mk_hash_command(char** args) {
+  Command cmd;
+
+  cmd.hash = (HashCommand) {
+    HASH,
+    args
+  };
+
+  return cmd;
+}
+
 // Create EOCCommand structure
 Command mk_eoc() {
+  return mk_list_eoc(LIST_END);
+}
+
+// Create EOCCommand structure connected to a following pipeline
+Command mk_list_eoc(ListOp next) {
   Command cmd;
 
   cmd.eoc = (EOCCommand) {
-    EOC
+    EOC,
+    next
   };
 
   return cmd;
@@ -205,10 +223,18 @@ static void __print_command(Command cmd) {
     __print_simple_cmd("EXIT");
     break;
 
-  case EOC:
-    printf("--- EOC ---");
+  case HASH:
+    printf("%%HASH%% ");
+    __print_generic_cmd(cmd.hash);
     break;
 
+  case EOC: {
+    static const char* ops[] = { "", " ;", " &&", " ||" };
+
+    printf("--- EOC%s ---", ops[cmd.eoc.next]);
+    break;
+  }
+
   default:
     printf("{???}");
   }
@@ -254,7 +280,9 @@ void debug_print_script(const CommandHolder* holders) {
   if (holders != NULL) {
     size_t i;
 
-    for (i = 0; get_command_holder_type(holders[i]) != EOC; ++i) {
+    // Every pipeline ends in an EOC, the last one ends the list
+    for (i = 0; get_command_holder_type(holders[i]) != EOC ||
+           holders[i].cmd.eoc.next != LIST_END; ++i) {
       __print_command_holder(holders[i]);
       printf("\n");
     }
@@ -61,7 +61,7 @@
  * @sa Command
  */
 typedef enum CommandType {
-  EOC = 0, // pseudo-command for marking the end of a script
+  EOC = 0, // pseudo-command for marking the end of a pipeline
   GENERIC,
   ECHO,
   EXPORT,
@@ -69,9 +69,22 @@ typedef enum CommandType {
   CD,
   PWD,
   JOBS,
-  EXIT
+  EXIT,
+  HASH
 } CommandType;
 
+/**
+ * @brief How a pipeline is connected to the pipeline after it in a command list
+ *
+ * @sa EOCCommand
+ */
+typedef enum ListOp {
+  LIST_END = 0, /**< Last pipeline of the script */
+  LIST_SEQ,     /**< `;` or `&`: the next pipeline always runs */
+  LIST_AND,     /**< `&&`: the next pipeline runs if this one succeeded */
+  LIST_OR       /**< `||`: the next pipeline runs if this one failed */
+} ListOp;
+
 // Command Structures
 //
 // All command structures must begin with the `CommandType type` field since this
@@ -168,11 +181,30 @@ typedef SimpleCommand JobsCommand;
 typedef SimpleCommand ExitCommand;
 
 /**
- * @brief Alias for @a SimpleCommand to denote the end of a command
+ * @brief Alias for @a GenericCommand to denote a command to show or change the
+ * table of resolved program paths
  *
- * @sa SimpleCommand, Command
+ * `hash` prints the table, `hash -r` forgets every entry and `hash name...`
+ * resolves the named programs ahead of time. The first argument is always
+ * "hash".
+ *
+ * @sa GenericCommand, Command
  */
-typedef SimpleCommand EOCCommand;
+typedef GenericCommand HashCommand;
+
+/**
+ * @brief Marks the end of a pipeline
+ *
+ * A script is a list of pipelines, each followed by an EOCCommand that tells
+ * how it connects to the next one. The EOCCommand of the last pipeline holds
+ * @a LIST_END.
+ *
+ * @sa ListOp, Command
+ */
+typedef struct EOCCommand {
+  CommandType type; /**< Type of command */
+  ListOp next;      /**< Connection to the next pipeline */
+} EOCCommand;
 
 /**
  * @brief Make all command types the same size and interchangeable
@@ -183,7 +215,7 @@ typedef SimpleCommand EOCCommand;
  *
  * @sa get_command_type, SimpleCommand, GenericCommand, EchoCommand,
  * ExportCommand, CDCommand, KillCommand, PWDCommand, JobsCommand, ExitCommand,
- * EOCCommand
+ * HashCommand, EOCCommand
  */
 typedef union Command {
   SimpleCommand simple;   /**< Read structure as a @a SimpleCommand */
@@ -195,6 +227,7 @@ typedef union Command {
   PWDCommand pwd;         /**< Read structure as a @a PWDCommand */
   JobsCommand jobs;       /**< Read structure as a @a JobsCommand */
   ExitCommand exit;       /**< Read structure as a @a ExitCommand */
+  HashCommand hash;       /**< Read structure as a @a HashCommand */
   EOCCommand eoc;         /**< Read structure as a @a EOCCommand */
 } Command;
 
@@ -342,7 +375,19 @@ Command mk_jobs_command();
 Command mk_exit_command();
 
 /**
- * @brief Create a @a EOCCommand structure and return a copy
+ * @brief Create a @a HashCommand structure and return a copy
+ *
+ * @param args A NULL terminated array of strings starting with "hash"
+ *
+ * @return Copy of constructed HashCommand as a @a Command
+ *
+ * @sa Command, HashCommand
+ */
+Command mk_hash_command(char** args);
+
+/**
+ * @brief Create a @a EOCCommand structure ending the last pipeline of a script
+ * and return a copy
  *
  * @return Copy of constructed EOCCommand as a @a Command
  *
@@ -350,6 +395,18 @@ Command mk_exit_command();
  */
 Command mk_eoc();
 
+/**
+ * @brief Create a @a EOCCommand structure ending a pipeline of a command list
+ * and return a copy
+ *
+ * @param next How the pipeline connects to the one after it
+ *
+ * @return Copy of constructed EOCCommand as a @a Command
+ *
+ * @sa Command, EOCCommand, ListOp
+ */
+Command mk_list_eoc(ListOp next);
+
 /**
  * @brief Get the type of the command
  *
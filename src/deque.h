@@ -2,6 +2,12 @@
  * @file deque.h
  *
  * @brief Double ended queue generators specialized to any given type.
+ *
+ * The generated functions are all static inline and live entirely in this
+ * header, so each one can be inlined at its call site. A deque is a ring over
+ * an array whose capacity is always a power of two. Positions are masked into
+ * the array instead of taken modulo its capacity, and the ring grows by
+ * doubling the array in place.
  */
 
 #ifndef SRC_DEQUE_H
@@ -11,24 +17,58 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/** @cond Doxygen_Suppress */
+// Allocation hooks of the deques generated by IMPLEMENT_DEQUE()
+static inline void* __deque_malloc(size_t size) {
+  void* ret = malloc(size);
+
+  if (ret == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate deque contents\n");
+    exit(-1);
+  }
+
+  return ret;
+}
+
+static inline void* __deque_realloc(void* data, size_t old_size, size_t size) {
+  (void) old_size;
+
+  void* ret = realloc(data, size);
+
+  if (ret == NULL) {
+    fprintf(stderr, "ERROR: Failed to reallocate deque contents\n");
+    exit(-1);
+  }
+
+  return ret;
+}
+
+static inline void __deque_free(void* data) {
+  free(data);
+}
+/** @endcond Doxygen_Suppress */
 
 /**
  * @def IMPLEMENT_DEQUE_STRUCT(struct_name, type)
  *
  * @brief Generates a structure for use with Double Ended Queues.
  *
- * Follow this call with either @a PROTOTYPE_DEQUE() (if in a header file) or @a
- * IMPLEMENT_DEQUE() to generate the functions
- * that correspond to this structure. The structure fields should not be
- * manually changed at any time. Instead use one of the generated functions from
- * the aforementioned macros.
+ * Follow this call with @a IMPLEMENT_DEQUE() or @a IMPLEMENT_DEQUE_ALLOCATOR()
+ * to generate the functions that correspond to this structure. The structure
+ * fields should not be manually changed at any time. Instead use one of the
+ * generated functions from the aforementioned macros.
+ *
+ * A second structure named struct_name##Span is generated as well. It
+ * describes a contiguous run of elements handed out by @a spans_Example().
  *
  * @param struct_name The name of the structure
  *
  * @param type The name of the type of elements stored in the @a struct_name
  * structure
  *
- * @sa PROTOTYPE_DEQUE, IMPLEMENT_DEQUE
+ * @sa IMPLEMENT_DEQUE, IMPLEMENT_DEQUE_ALLOCATOR
 */
 #define IMPLEMENT_DEQUE_STRUCT(struct_name, type)                       \
   typedef struct struct_name {                                          \
@@ -38,92 +78,121 @@
     size_t back;                                                        \
                                                                         \
     void (*destructor)(type);                                           \
-  } struct_name;
+  } struct_name;                                                        \
+                                                                        \
+  typedef struct struct_name##Span {                                    \
+    type* data;                                                         \
+    size_t len;                                                         \
+  } struct_name##Span;
 
 /**
- * @def PROTOTYPE_DEQUE(struct_name, type)
- *
- * @brief Generates prototypes for functions that manipulate Double Ended Queue
- * structures.
+ * @def IMPLEMENT_DEQUE(struct_name, type)
  *
- * This is intended for use in a header file or anywhere you need a forward
- * declaration of these functions. This does not actually implement these
- * functions.
+ * @brief Generates a @a malloc based set of functions for use with a structure
+ * generated by @a IMPLEMENT_DEQUE_STRUCT()
  *
  * @param struct_name The name of the structure
  *
  * @param type The name of the type of elements stored in the @a struct_name
  * structure
  *
- * @sa IMPLEMENT_DEQUE_STRUCT(), IMPLEMENT_DEQUE()
+ * @sa IMPLEMENT_DEQUE_STRUCT(), IMPLEMENT_DEQUE_ALLOCATOR()
  */
-#define PROTOTYPE_DEQUE(struct_name, type)                              \
-  struct_name new_##struct_name(size_t);                                \
-  struct_name new_destructable_##struct_name(size_t, void (*)(type));   \
-  void destroy_##struct_name(struct_name*);                             \
-  void empty_##struct_name(struct_name*);                               \
-  bool is_empty_##struct_name(struct_name*);                            \
-  size_t length_##struct_name(struct_name*);                            \
-  type* as_array_##struct_name(struct_name*, size_t*);                  \
-  void apply_##struct_name(struct_name*, void (*)(type));               \
-  void push_front_##struct_name(struct_name*, type);                    \
-  void push_back_##struct_name(struct_name*, type);                     \
-  type pop_front_##struct_name(struct_name*);                           \
-  type pop_back_##struct_name(struct_name*);                            \
-  type peek_front_##struct_name(struct_name*);                          \
-  type peek_back_##struct_name(struct_name*);                           \
-  void update_front_##struct_name(struct_name*, type);                  \
-  void update_back_##struct_name(struct_name*, type);                   \
-  void update_and_destroy_front_##struct_name(struct_name*, type);      \
-  void update_and_destroy_back_##struct_name(struct_name*, type);
+#define IMPLEMENT_DEQUE(struct_name, type)                              \
+  IMPLEMENT_DEQUE_ALLOCATOR(struct_name, type, __deque_malloc,          \
+                            __deque_realloc, __deque_free)
 
 /**
- * @def IMPLEMENT_DEQUE(struct_name, type)
+ * @def IMPLEMENT_DEQUE_ALLOCATOR(struct_name, type, alloc, resize, release)
  *
- * @brief Generates a @a malloc based set of functions for use with a structure
- * generated by @a IMPLEMENT_DEQUE_STRUCT()
+ * @brief Generates a set of functions for use with a structure generated by @a
+ * IMPLEMENT_DEQUE_STRUCT() that get their memory from the given functions
+ *
+ * The front and back fields count pushes and pops without ever being wrapped.
+ * Only masking them with the capacity turns them into array indices, so the
+ * length is always their difference and no slot has to be left free to tell a
+ * full ring from an empty one.
  *
  * @param struct_name The name of the structure
  *
  * @param type The name of the type of elements stored in the @a struct_name
  * structure
  *
- * @sa IMPLEMENT_DEQUE_STRUCT(), PROTOTYPE_DEQUE()
+ * @param alloc A function like malloc() that never returns NULL
+ *
+ * @param resize A function taking an array, its size and a larger size that
+ * returns an array of the larger size starting with the contents of the old
+ * one, like realloc() but never returning NULL
+ *
+ * @param release A function like free() that gives an array back
+ *
+ * @sa IMPLEMENT_DEQUE_STRUCT(), IMPLEMENT_DEQUE()
  */
-#define IMPLEMENT_DEQUE(struct_name, type)                              \
-                                                                        \
-  void apply_##struct_name(struct_name*, void (*)(type));               \
+#define IMPLEMENT_DEQUE_ALLOCATOR(struct_name, type, alloc, resize, release) \
                                                                         \
-  struct_name new_##struct_name(size_t init_cap) {                      \
+  static inline struct_name new_##struct_name(size_t init_cap) {        \
     struct_name ret;                                                    \
                                                                         \
-    if (init_cap > 0)                                                   \
-      ret.cap = init_cap;                                               \
-    else                                                                \
-      ret.cap = 1;                                                      \
-                                                                        \
-    ret.data = (type*) malloc(ret.cap * sizeof(type));                  \
-                                                                        \
-    if (ret.data == NULL) {                                             \
-      fprintf(stderr, "ERROR: Failed to allocate struct_name"           \
-              " contents");                                             \
-      exit(-1);                                                         \
-    }                                                                   \
+    ret.cap = 1;                                                        \
+    while (ret.cap < init_cap)                                          \
+      ret.cap <<= 1;                                                    \
                                                                         \
+    ret.data = (type*) alloc(ret.cap * sizeof(type));                   \
     ret.front = ret.back = 0;                                           \
     ret.destructor = NULL;                                              \
                                                                         \
     return ret;                                                         \
   }                                                                     \
                                                                         \
-  struct_name new_destructable_##struct_name(size_t init_cap,           \
-                                             void (*destructor)(type)){ \
+  static inline struct_name                                             \
+  new_destructable_##struct_name(size_t init_cap, void (*destructor)(type)) { \
     struct_name ret = new_##struct_name(init_cap);                      \
     ret.destructor = destructor;                                        \
     return ret;                                                         \
   }                                                                     \
                                                                         \
-  void destroy_##struct_name(struct_name* deq) {                        \
+  static inline bool is_empty_##struct_name(struct_name* deq) {         \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    return deq->front == deq->back;                                     \
+  }                                                                     \
+                                                                        \
+  static inline size_t length_##struct_name(struct_name* deq) {         \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    return deq->back - deq->front;                                      \
+  }                                                                     \
+                                                                        \
+  /* Array slot of the element i places behind the front */             \
+  static inline type* __at_##struct_name(struct_name* deq, size_t i) {  \
+    return &deq->data[(deq->front + i) & (deq->cap - 1)];               \
+  }                                                                     \
+                                                                        \
+  static inline void spans_##struct_name(struct_name* deq,              \
+                                         struct_name##Span spans[2]) {  \
+    size_t len = length_##struct_name(deq);                             \
+    size_t start = deq->front & (deq->cap - 1);                         \
+    size_t first = deq->cap - start;                                    \
+                                                                        \
+    if (first > len)                                                    \
+      first = len;                                                      \
+                                                                        \
+    spans[0] = (struct_name##Span) { deq->data + start, first };        \
+    spans[1] = (struct_name##Span) { deq->data, len - first };          \
+  }                                                                     \
+                                                                        \
+  static inline void apply_##struct_name(struct_name* deq,              \
+                                         void (*func)(type)) {          \
+    struct_name##Span spans[2];                                         \
+                                                                        \
+    spans_##struct_name(deq, spans);                                    \
+                                                                        \
+    for (int s = 0; s < 2; ++s)                                         \
+      for (size_t i = 0; i < spans[s].len; ++i)                         \
+        func(spans[s].data[i]);                                         \
+  }                                                                     \
+                                                                        \
+  static inline void destroy_##struct_name(struct_name* deq) {          \
     assert(deq != NULL);                                                \
                                                                         \
     if (deq->data == NULL)                                              \
@@ -132,14 +201,13 @@
     if (deq->destructor != NULL)                                        \
       apply_##struct_name(deq, deq->destructor);                        \
                                                                         \
-    if (deq->data != NULL)                                              \
-      free(deq->data);                                                  \
+    release(deq->data);                                                 \
                                                                         \
     deq->data = NULL;                                                   \
     deq->cap = deq->front = deq->back = 0;                              \
   }                                                                     \
                                                                         \
-  void empty_##struct_name(struct_name* deq) {                          \
+  static inline void empty_##struct_name(struct_name* deq) {            \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
                                                                         \
@@ -149,56 +217,63 @@
     deq->front = deq->back = 0;                                         \
   }                                                                     \
                                                                         \
-  bool is_empty_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return deq->front == deq->back;                                     \
-  }                                                                     \
-                                                                        \
-  size_t length_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return (deq->back - deq->front + deq->cap) % deq->cap;              \
-  }                                                                     \
-                                                                        \
-  static void __reallign_##struct_name(struct_name* deq) {              \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+  /* Make room for n more elements. The array doubles until they fit and the \
+   * part of the ring that wrapped around to the start of the old array is \
+   * moved up behind its old end, where the larger mask expects it. */  \
+  static inline void __reserve_##struct_name(struct_name* deq, size_t n) { \
+    size_t len = length_##struct_name(deq);                             \
                                                                         \
-    if (deq->front != 0) {                                              \
-      type* old_data = deq->data;                                       \
-      size_t len = length_##struct_name(deq);                           \
+    if (len + n <= deq->cap)                                            \
+      return;                                                           \
                                                                         \
-      deq->data = (type*) malloc(deq->cap * sizeof(type));              \
+    size_t old_cap = deq->cap;                                          \
+    size_t start = deq->front & (old_cap - 1);                          \
+    size_t cap = 2 * old_cap;                                           \
                                                                         \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents");                                           \
-        abort();                                                        \
-      }                                                                 \
+    while (cap < len + n)                                               \
+      cap <<= 1;                                                        \
                                                                         \
-      size_t i;                                                         \
+    deq->data = (type*) resize(deq->data, old_cap * sizeof(type),       \
+                               cap * sizeof(type));                     \
+    deq->cap = cap;                                                     \
                                                                         \
-      for (i = 0; i < len; ++i)                                         \
-        deq->data[i] = old_data[(deq->front + i) % deq->cap];           \
+    if (start + len > old_cap)                                          \
+      memcpy(deq->data + old_cap, deq->data,                            \
+             (start + len - old_cap) * sizeof(type));                   \
                                                                         \
-      free(old_data);                                                   \
+    deq->front = start;                                                 \
+    deq->back = start + len;                                            \
+  }                                                                     \
                                                                         \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
+  static inline void __on_pop_##struct_name(struct_name* deq, size_t n) { \
+    if (length_##struct_name(deq) < n) {                                \
+      fprintf(stderr, "ERROR: Cannot pop from " #struct_name " while it " \
+              "is empty\n");                                            \
+      abort();                                                          \
     }                                                                   \
   }                                                                     \
                                                                         \
-  type* as_array_##struct_name(struct_name* deq, size_t* len) {         \
+  static inline type* as_array_##struct_name(struct_name* deq, size_t* len) { \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
                                                                         \
-    __reallign_##struct_name(deq);                                      \
-                                                                        \
+    struct_name##Span spans[2];                                         \
     type* ret = deq->data;                                              \
                                                                         \
+    spans_##struct_name(deq, spans);                                    \
+                                                                        \
+    if (spans[1].len == 0) {                                            \
+      memmove(ret, spans[0].data, spans[0].len * sizeof(type));         \
+    }                                                                   \
+    else {                                                              \
+      ret = (type*) alloc(deq->cap * sizeof(type));                     \
+      memcpy(ret, spans[0].data, spans[0].len * sizeof(type));          \
+      memcpy(ret + spans[0].len, spans[1].data, spans[1].len * sizeof(type)); \
+      release(deq->data);                                               \
+    }                                                                   \
+                                                                        \
     if (len != NULL)                                                    \
-      *len = length_##struct_name(deq);                                 \
+      *len = spans[0].len + spans[1].len;                               \
                                                                         \
     deq->data = NULL;                                                   \
     deq->cap = deq->front = deq->back = 0;                              \
@@ -206,138 +281,139 @@
     return ret;                                                         \
   }                                                                     \
                                                                         \
-  void apply_##struct_name(struct_name* deq, void (*func)(type)) {      \
+  static inline void push_front_##struct_name(struct_name* deq,         \
+                                              type element) {           \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    size_t len = length_##struct_name(deq);                             \
-                                                                        \
-    for (size_t i = 0; i < len; ++i) {                                  \
-      func(deq->data[(deq->front + i) % deq->cap]);                     \
-    }                                                                   \
+    __reserve_##struct_name(deq, 1);                                    \
+    --deq->front;                                                       \
+    *__at_##struct_name(deq, 0) = element;                              \
   }                                                                     \
                                                                         \
-  static void __on_push_##struct_name(struct_name* deq) {               \
-    if (deq->front == (deq->back + 1) % deq->cap) {                     \
-      type* old_data = deq->data;                                       \
-      size_t old_cap = deq->cap;                                        \
-                                                                        \
-      deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) malloc(deq->cap * sizeof(type));              \
+  static inline void push_back_##struct_name(struct_name* deq,          \
+                                             type element) {            \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    __reserve_##struct_name(deq, 1);                                    \
+    deq->data[deq->back & (deq->cap - 1)] = element;                    \
+    ++deq->back;                                                        \
+  }                                                                     \
                                                                         \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents\n");                                         \
-        abort();                                                        \
-      }                                                                 \
+  static inline void push_back_n_##struct_name(struct_name* deq,        \
+                                               const type* elements,    \
+                                               size_t n) {              \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
                                                                         \
-      size_t i;                                                         \
+    if (n == 0)                                                         \
+      return;                                                           \
                                                                         \
-      for (i = 0; i < old_cap - 1; ++i)                                 \
-        deq->data[i] = old_data[(deq->front + i) % old_cap];            \
+    __reserve_##struct_name(deq, n);                                    \
                                                                         \
-      free(old_data);                                                   \
+    size_t start = deq->back & (deq->cap - 1);                          \
+    size_t first = deq->cap - start;                                    \
                                                                         \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
-    }                                                                   \
-  }                                                                     \
+    if (first > n)                                                      \
+      first = n;                                                        \
                                                                         \
-  static void __on_pop_##struct_name(struct_name* deq) {                \
-    if (is_empty_##struct_name(deq)) {                                  \
-      fprintf(stderr, "ERROR: Cannot pop from of struct_name while it " \
-              "is empty\n");                                            \
-      abort();                                                          \
-    }                                                                   \
+    memcpy(deq->data + start, elements, first * sizeof(type));          \
+    memcpy(deq->data, elements + first, (n - first) * sizeof(type));    \
+    deq->back += n;                                                     \
   }                                                                     \
                                                                         \
-  void push_front_##struct_name(struct_name* deq, type element) {       \
+  static inline type pop_front_##struct_name(struct_name* deq) {        \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->front = (deq->front + deq->cap - 1) % deq->cap;                \
-    deq->data[deq->front] = element;                                    \
+    __on_pop_##struct_name(deq, 1);                                     \
+    type ret = *__at_##struct_name(deq, 0);                             \
+    ++deq->front;                                                       \
+    return ret;                                                         \
   }                                                                     \
                                                                         \
-  void push_back_##struct_name(struct_name* deq, type element) {        \
+  static inline void pop_front_n_##struct_name(struct_name* deq,        \
+                                               type* elements, size_t n) { \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->data[deq->back] = element;                                     \
-    deq->back = (deq->back + 1) % deq->cap;                             \
-  }                                                                     \
+    __on_pop_##struct_name(deq, n);                                     \
                                                                         \
-  type pop_front_##struct_name(struct_name* deq) {                      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_pop_##struct_name(deq);                                        \
-    size_t old_front = deq->front;                                      \
-    deq->front = (deq->front + 1) % deq->cap;                           \
-    return deq->data[old_front];                                        \
+    if (elements != NULL && n > 0) {                                    \
+      struct_name##Span spans[2];                                       \
+                                                                        \
+      spans_##struct_name(deq, spans);                                  \
+                                                                        \
+      size_t first = (spans[0].len < n) ? spans[0].len : n;             \
+                                                                        \
+      memcpy(elements, spans[0].data, first * sizeof(type));            \
+      memcpy(elements + first, spans[1].data, (n - first) * sizeof(type)); \
+    }                                                                   \
+                                                                        \
+    deq->front += n;                                                    \
   }                                                                     \
                                                                         \
-  type pop_back_##struct_name(struct_name* deq) {                       \
+  static inline type pop_back_##struct_name(struct_name* deq) {         \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_pop_##struct_name(deq);                                        \
-    deq->back = (deq->back + deq->cap - 1) % deq->cap;                  \
-    return deq->data[deq->back];                                        \
+    __on_pop_##struct_name(deq, 1);                                     \
+    --deq->back;                                                        \
+    return deq->data[deq->back & (deq->cap - 1)];                       \
   }                                                                     \
                                                                         \
-  type peek_front_##struct_name(struct_name* deq) {                     \
+  static inline type peek_front_##struct_name(struct_name* deq) {       \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[deq->front];                                       \
+    return *__at_##struct_name(deq, 0);                                 \
   }                                                                     \
                                                                         \
-  type peek_back_##struct_name(struct_name* deq) {                      \
+  static inline type peek_back_##struct_name(struct_name* deq) {        \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[(deq->back + deq->cap - 1) % deq->cap];            \
+    return deq->data[(deq->back - 1) & (deq->cap - 1)];                 \
   }                                                                     \
                                                                         \
-  void update_front_##struct_name(struct_name* deq, type element) {     \
+  static inline void update_front_##struct_name(struct_name* deq,       \
+                                                type element) {         \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    deq->data[deq->front] = element;                                    \
+    *__at_##struct_name(deq, 0) = element;                              \
   }                                                                     \
                                                                         \
-  void update_back_##struct_name(struct_name* deq, type element) {      \
+  static inline void update_back_##struct_name(struct_name* deq,        \
+                                               type element) {          \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    deq->data[(deq->back + deq->cap - 1) % deq->cap] = element;         \
+    deq->data[(deq->back - 1) & (deq->cap - 1)] = element;              \
   }                                                                     \
                                                                         \
-  void update_and_destroy_front_##struct_name(struct_name* deq,         \
-                                              type element) {           \
+  static inline void update_and_destroy_front_##struct_name(struct_name* deq, \
+                                                            type element) { \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
                                                                         \
-    size_t idx = deq->front;                                            \
+    type* slot = __at_##struct_name(deq, 0);                            \
                                                                         \
     if (deq->destructor != NULL)                                        \
-      deq->destructor(deq->data[idx]);                                  \
+      deq->destructor(*slot);                                           \
                                                                         \
-    deq->data[idx] = element;                                           \
+    *slot = element;                                                    \
   }                                                                     \
                                                                         \
-  void update_and_destroy_back_##struct_name(struct_name* deq,          \
-                                             type element) {            \
+  static inline void update_and_destroy_back_##struct_name(struct_name* deq, \
+                                                           type element) { \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
                                                                         \
-    size_t idx = (deq->back + deq->cap - 1) % deq->cap;                 \
+    type* slot = &deq->data[(deq->back - 1) & (deq->cap - 1)];          \
                                                                         \
     if (deq->destructor != NULL)                                        \
-      deq->destructor(deq->data[idx]);                                  \
+      deq->destructor(*slot);                                           \
                                                                         \
-    deq->data[idx] = element;                                           \
+    *slot = element;                                                    \
   }
 
 // The following deque is for example and documentation purposes only
@@ -362,8 +438,9 @@ typedef char Type;
 typedef struct Example {
   Type* data;   /**< The array holding the deque */
   size_t cap;   /**< The current capacity of the deque */
-  size_t front; /**< The index of the element at the front of the deque */
-  size_t back;  /**< The index one greater than the last element of the queue */
+  size_t front; /**< Position of the element at the front of the deque. Masked
+                 *  with cap - 1 it is an index into data. */
+  size_t back;  /**< Position one past the last element of the deque */
 
   void (*destructor)(Type); /**< Optional destructor function pointer for the
                              *  data type. This is called on every element in
@@ -376,6 +453,20 @@ typedef struct Example {
 } Example; /**< @brief This way you do not have to type "struct Example" each
             *  time you wish to refer to an Example structure */
 
+/**
+ * @struct ExampleSpan
+ *
+ * @brief A run of elements of an @a Example deque that is contiguous in memory
+ *
+ * @sa spans_Example()
+ */
+// The following is the second struct created by the expansion of
+// IMPLEMENT_DEQUE_STRUCT(Example, Type);
+typedef struct ExampleSpan {
+  Type* data; /**< The first element of the run */
+  size_t len; /**< The number of elements in the run */
+} ExampleSpan;
+
 /**
  * @fn Example new_Example(size_t init_cap)
  *
@@ -484,6 +575,23 @@ typedef struct Example {
  *
  * @sa Example, Type
  */
+/**
+ * @fn void spans_Example(Example* deq, ExampleSpan spans[2])
+ *
+ * @brief Get the contents of the deque as two runs of contiguous elements
+ *
+ * The elements from the front of the deque up to the end of its array are the
+ * first run and the elements that wrapped around to the start of the array are
+ * the second. Either run may be empty. Walking both in order visits the deque
+ * from front to back without taking anything out of it. The runs stay valid
+ * until the next push.
+ *
+ * @param deq A pointer to the deque to look into
+ *
+ * @param[out] spans The first and the second run
+ *
+ * @sa Example, ExampleSpan
+ */
 /**
  * @fn void push_front_Example(Example* deq, Type element)
  *
@@ -506,6 +614,23 @@ typedef struct Example {
  *
  * @sa Example, Type
  */
+/**
+ * @fn void push_back_n_Example(Example* deq, const Type* elements, size_t n)
+ *
+ * @brief Insert n elements to the back of the deque in the order they appear in
+ * the array elements
+ *
+ * The deque grows at most once and the elements are copied in at most two
+ * pieces.
+ *
+ * @param deq A pointer to the deque to insert the elements
+ *
+ * @param elements The elements to copy into the deque
+ *
+ * @param n The number of elements to copy
+ *
+ * @sa Example, Type
+ */
 /**
  * @fn Type pop_front_Example(Example* deq)
  *
@@ -517,6 +642,21 @@ typedef struct Example {
  *
  * @sa Example, Type
  */
+/**
+ * @fn void pop_front_n_Example(Example* deq, Type* elements, size_t n)
+ *
+ * @brief Remove n elements from the front of the deque
+ *
+ * @param deq A pointer to the deque to remove the elements from
+ *
+ * @param[out] elements An array of at least n elements the removed elements are
+ * copied to in order, or NULL to drop them
+ *
+ * @param n The number of elements to remove. There must be at least this many
+ * elements in the deque.
+ *
+ * @sa Example, Type
+ */
 /**
  * @fn Type pop_back_Example(Example* deq)
  *
@@ -628,6 +768,5 @@ typedef struct Example {
  *
  * @sa Example, Type
  */
-PROTOTYPE_DEQUE(Example, Type);
 
 #endif //SRC_DEQUE_H
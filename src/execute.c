@@ -7,42 +7,150 @@
  * @note As you add things to this file you may want to change the method signature
  */
 
+#define _GNU_SOURCE
+
 #include "execute.h"
 
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/signalfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include "hash_map.h"
+#include "output.h"
+#include "parsing_interface.h"
 #include "quash.h"
+#include "zygote.h"
 
+extern char** environ;
 
-IMPLEMENT_DEQUE_STRUCT(PIDDeque, pid_t);
-IMPLEMENT_DEQUE(PIDDeque, pid_t);
+// Number of process ids a job holds without allocating. Almost every job is a
+// single program or a short pipeline.
+#define PID_LIST_INLINE (4)
 
-// declare a global pipe
-int p1[2];
+/**
+ * @brief Process ids of a job in the order they were started
+ *
+ * The first @a PID_LIST_INLINE ids are stored in the structure itself, so
+ * short jobs need no allocation of their own. Longer jobs move the ids to the
+ * heap. Nothing points into the structure, so it may be copied freely.
+ */
+typedef struct PIDList {
+  union {
+    pid_t inline_pids[PID_LIST_INLINE]; /**< Used while cap is PID_LIST_INLINE */
+    pid_t* heap;                        /**< Used once the list outgrew that */
+  };
+  size_t len; /**< Number of ids in the list */
+  size_t cap; /**< Number of ids that fit without growing */
+} PIDList;
+
+/**
+ * @brief One pipe for every @a PIPE_OUT boundary of a job
+ *
+ * Pipe i connects the standard out of stage i to the standard in of stage
+ * i + 1. Every end is opened close-on-exec so a program only inherits the ends
+ * that were dup2()'d onto its standard streams.
+ */
+typedef struct PipeTable {
+  int (*fds)[2]; /**< The read (0) and write (1) end of each pipe */
+  size_t len;    /**< Number of pipes in the table */
+} PipeTable;
 
 typedef struct Job {
   int job_id;
   char* cmd; 
-  PIDDeque pid_list;
-  bool isComplete;
+  PIDList pid_list;
+  pid_t pgid;     // process group shared by every process of the job
+  size_t running; // processes in pid_list that have not been reaped yet
+  bool stopped;   // stopped in the foreground and not resumed since
+  int gate[2];    // pipe builtin processes wait on until the job is announced
 } Job;
 
-IMPLEMENT_DEQUE_STRUCT(JobDeque, Job);
-IMPLEMENT_DEQUE(JobDeque, Job);
+IMPLEMENT_DEQUE_STRUCT(JobIdDeque, int);
+IMPLEMENT_DEQUE(JobIdDeque, int);
 
-static JobDeque jobs;
-bool isJobDequeInit = false;
+// Maps the pid of every unreaped background process to the id of its job.
+// Jobs move when the job table grows, so they are never referred to by
+// pointer for longer than a single command.
+IMPLEMENT_HASH_MAP_STRUCT(PIDIndex, pid_t, int);
+IMPLEMENT_HASH_MAP(PIDIndex, pid_t, int, hash_int, equals_int);
 
-// Remove this and all expansion calls to it
 /**
- * @brief Note calls to any function that requires implementation
+ * @brief Background jobs indexed by their job id
+ *
+ * Job ids are handed out like bash does: a new job gets one more than the
+ * highest id still in use, so ids of finished jobs at the top are recycled.
+ * That keeps ids dense enough to store the jobs themselves in one array
+ * indexed by id, which listing the jobs walks from start to end.
  */
-#define IMPLEMENT_ME()                                                  \
-  fprintf(stderr, "IMPLEMENT ME: %s(line %d): %s()\n", __FILE__, __LINE__, __FUNCTION__)
+typedef struct JobTable {
+  Job* slots;   /**< slots[id - 1] is the job with that id. Its job_id is 0
+                 *   while the slot is free. */
+  size_t cap;   /**< Number of slots allocated */
+  int max_id;   /**< Highest job id in use or 0 if there are no jobs */
+  size_t len;   /**< Number of jobs in the table */
+} JobTable;
+
+// Quash's environment, mapping variable names to values. environ is only read
+// once to fill it. getenv() scans environ linearly on every call, this is a
+// single probe.
+IMPLEMENT_HASH_MAP_STRUCT(EnvTable, char*, char*);
+IMPLEMENT_HASH_MAP(EnvTable, char*, char*, hash_str, equals_str);
+
+static EnvTable env_table;
+static bool isEnvTableInit = false;
+
+// The table in the "NAME=value" form programs are started with. It is built
+// when a program is started after a variable changed and freed with one call.
+static char** env_block = NULL;
+
+/**
+ * @brief A program found by searching PATH
+ */
+typedef struct CommandPath {
+  char* path; /**< Absolute path of the program */
+  int hits;   /**< Number of times the path was used */
+} CommandPath;
+
+// Maps program names to where PATH resolved them, like the hash builtin of
+// bash. Launching then costs one execve() instead of one per PATH directory
+// tried before the program is found. Emptied whenever PATH changes.
+IMPLEMENT_HASH_MAP_STRUCT(CommandTable, char*, CommandPath);
+IMPLEMENT_HASH_MAP(CommandTable, char*, CommandPath, hash_str, equals_str);
+
+static CommandTable command_table;
+static bool isCommandTableInit = false;
+
+static JobTable jobs;
+static PIDIndex pid_index;
+static bool job_table_ready = false;
+
+// Ids of jobs whose last process was reaped but which have not been reported
+// yet
+static JobIdDeque finished_jobs;
+
+// SIGCHLD is blocked in quash and read from this descriptor instead, so exits
+// are queued by the kernel and only looked at when something actually exited
+static int sigchld_fd = -1;
+
+// Signal mask quash started with. Children get it back before they run.
+static sigset_t child_sigmask;
+
+// Signals quash ignores for job control that children must see as default
+static sigset_t child_sigdefault;
+
+// Exit status of the last stage of the last foreground job, like bash's $?
+static int last_exit_status = 0;
+
+// True if quash owns the terminal it reads from. Only then does every job get
+// a process group of its own and the terminal while it runs in the foreground.
+static bool job_control = false;
 
 /***************************************************************************
  * Interface Functions
@@ -64,17 +172,408 @@ char* get_current_directory(bool* should_free) {
 
 }
 
-// Returns the value of an environment riable env_var
+static void destroy_env_entry(char* env_var, char* val) {
+  free(env_var);
+  free(val);
+}
+
+// Copy the environment quash was started with into the table the first time
+// it is needed
+static void initialize_env() {
+  if (isEnvTableInit)
+    return;
+
+  size_t len = 0;
+
+  while (environ[len] != NULL)
+    ++len;
+
+  env_table = new_destructable_EnvTable(2 * len, destroy_env_entry);
+
+  for (size_t i = 0; i < len; ++i) {
+    const char* eq = strchr(environ[i], '=');
+
+    if (eq != NULL)
+      insert_EnvTable(&env_table, strndup(environ[i], eq - environ[i]),
+                      strdup(eq + 1));
+  }
+
+  isEnvTableInit = true;
+}
+
+static void destroy_command_path(char* name, CommandPath cmd_path) {
+  free(name);
+  free(cmd_path.path);
+}
+
+static void initialize_command_table() {
+  if (isCommandTableInit)
+    return;
+
+  command_table = new_destructable_CommandTable(64, destroy_command_path);
+  isCommandTableInit = true;
+}
+
+// Free the environment and program path tables
+void destroy_env() {
+  if (isEnvTableInit) {
+    destroy_EnvTable(&env_table);
+    isEnvTableInit = false;
+  }
+
+  free(env_block);
+  env_block = NULL;
+
+  if (isCommandTableInit) {
+    destroy_CommandTable(&command_table);
+    isCommandTableInit = false;
+  }
+}
+
+// Get the environment programs are started with. The pointers and the strings
+// they point to share one allocation.
+static char** environment() {
+  initialize_env();
+
+  if (env_block != NULL)
+    return env_block;
+
+  size_t size = (env_table.len + 1) * sizeof(char*);
+
+  for (size_t i = 0; i < env_table.cap; ++i)
+    if (env_table.data[i].used)
+      size += strlen(env_table.data[i].key) +
+              strlen(env_table.data[i].value) + 2;
+
+  env_block = malloc(size);
+
+  if (env_block == NULL) {
+    perror("ERROR: Failed to allocate environment");
+    exit(-1);
+  }
+
+  char** next_var = env_block;
+  char* next_str = (char*) (env_block + env_table.len + 1);
+
+  for (size_t i = 0; i < env_table.cap; ++i) {
+    if (env_table.data[i].used) {
+      *next_var++ = next_str;
+      next_str += sprintf(next_str, "%s=%s", env_table.data[i].key,
+                          env_table.data[i].value) + 1;
+    }
+  }
+
+  *next_var = NULL;
+
+  return env_block;
+}
+
+// Returns the value of an environment variable env_var
 const char* lookup_env(const char* env_var) {
   // Lookup environment variables. This is required for parser to be able
   // to interpret variables from the command line and display the prompt
   // correctly
-  // HINT: This should be pretty simple
+  initialize_env();
+
+  char** val = lookup_EnvTable(&env_table, (char*) env_var);
+
+  return val != NULL ? *val : NULL;
+}
+
+// Sets an environment variable. Only the table holds it, programs get it from
+// environment().
+void write_env(const char* env_var, const char* val) {
+  initialize_env();
+
+  insert_EnvTable(&env_table, strdup(env_var), strdup(val));
+
+  free(env_block);
+  env_block = NULL;
+
+  // Programs may now resolve to different paths
+  if (isCommandTableInit && strcmp(env_var, "PATH") == 0)
+    empty_CommandTable(&command_table);
+}
+
+// Find an executable regular file called name in the directories of PATH.
+// Returns a malloc'd path or NULL.
+static char* search_path(const char* name) {
+  const char* dir = lookup_env("PATH");
+  size_t name_len = strlen(name);
+
+  // Same default search path as execvp()
+  if (dir == NULL)
+    dir = "/bin:/usr/bin";
+
+  while (true) {
+    const char* end = strchrnul(dir, ':');
+    size_t dir_len = end - dir;
+    char* path = malloc(dir_len + name_len + 3);
+    struct stat st;
+
+    if (path == NULL) {
+      perror("ERROR: Failed to allocate path");
+      return NULL;
+    }
+
+    // An empty entry means the current directory
+    if (dir_len == 0)
+      path[dir_len++] = '.';
+    else
+      memcpy(path, dir, dir_len);
+
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0)
+      return path;
 
-  // Remove warning silencers
-  //(void) env_var; // Silence unused variable warning
+    free(path);
 
-  return getenv(env_var);
+    if (*end == '\0')
+      return NULL;
+
+    dir = end + 1;
+  }
+}
+
+// Get the path a program should be executed from. Names containing a slash are
+// used as they are, anything else is looked up in the command table and
+// searched for in PATH on a miss. Returns NULL with errno set to ENOENT if the
+// program does not exist.
+static const char* resolve_command(const char* name) {
+  if (strchr(name, '/') != NULL)
+    return name;
+
+  initialize_command_table();
+
+  CommandPath* found = lookup_CommandTable(&command_table, (char*) name);
+
+  if (found != NULL) {
+    ++found->hits;
+    return found->path;
+  }
+
+  char* path = search_path(name);
+
+  if (path == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  insert_CommandTable(&command_table, strdup(name), (CommandPath) { path, 1 });
+
+  return path;
+}
+
+// Forget where a program was found, after it turned out to be gone
+static void forget_command(const char* name) {
+  if (isCommandTableInit)
+    remove_CommandTable(&command_table, (char*) name);
+}
+
+// Set up the job list and SIGCHLD handling the first time they are needed
+static void initialize_jobs() {
+  if (job_table_ready)
+    return;
+
+  jobs = (JobTable) { NULL, 0, 0, 0 };
+  finished_jobs = new_JobIdDeque(16);
+  pid_index = new_PIDIndex(16);
+
+  sigset_t chld;
+
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &child_sigmask);
+
+  // Whether quash prints a prompt says nothing about the terminal. A script
+  // run with -f from a terminal still has to hand it to the jobs that read
+  // from it, while quash run in a pipeline or in the background must leave it
+  // and its process group alone.
+  job_control = isatty(STDIN_FILENO) &&
+                tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+  // Quash hands the terminal to foreground jobs and takes it back afterwards,
+  // which it can only do from the background with SIGTTOU ignored
+  sigemptyset(&child_sigdefault);
+
+  if (job_control) {
+    signal(SIGTTOU, SIG_IGN);
+    sigaddset(&child_sigdefault, SIGTTOU);
+  }
+
+  sigchld_fd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  if (sigchld_fd == -1)
+    perror("ERROR: Failed to watch for SIGCHLD");
+
+  // Fork the zygote while quash is still small. Builtins fall back to forking
+  // quash if it cannot be started or is turned off.
+  const char* no_zygote = lookup_env("QUASH_NO_ZYGOTE");
+
+  if (no_zygote == NULL || no_zygote[0] == '\0')
+    start_zygote(&child_sigmask, &child_sigdefault);
+
+  job_table_ready = true;
+}
+
+// Create an empty pid list that uses its inline storage
+static PIDList new_PIDList() {
+  PIDList list;
+
+  list.len = 0;
+  list.cap = PID_LIST_INLINE;
+
+  return list;
+}
+
+// The ids of a pid list in the order they were added
+static pid_t* pids_of_PIDList(PIDList* list) {
+  return (list->cap == PID_LIST_INLINE) ? list->inline_pids : list->heap;
+}
+
+// Add a pid to the end of a pid list, moving it to the heap if it is full
+static void push_PIDList(PIDList* list, pid_t pid) {
+  if (list->len == list->cap) {
+    size_t cap = 2 * list->cap;
+    pid_t* heap;
+
+    if (list->cap == PID_LIST_INLINE) {
+      heap = malloc(cap * sizeof(pid_t));
+
+      if (heap != NULL)
+        memcpy(heap, list->inline_pids, list->len * sizeof(pid_t));
+    }
+    else {
+      heap = realloc(list->heap, cap * sizeof(pid_t));
+    }
+
+    if (heap == NULL) {
+      perror("ERROR: Failed to grow the pid list");
+      abort();
+    }
+
+    list->heap = heap;
+    list->cap = cap;
+  }
+
+  pids_of_PIDList(list)[list->len++] = pid;
+}
+
+// Check whether a process is in a pid list
+static bool contains_PIDList(PIDList* list, pid_t pid) {
+  pid_t* pids = pids_of_PIDList(list);
+
+  for (size_t i = 0; i < list->len; ++i)
+    if (pids[i] == pid)
+      return true;
+
+  return false;
+}
+
+// Free the heap storage of a pid list if it ever needed some
+static void destroy_PIDList(PIDList* list) {
+  if (list->cap != PID_LIST_INLINE)
+    free(list->heap);
+
+  *list = new_PIDList();
+}
+
+// Free what a background job owns once all of its processes have been reaped
+static void destroy_job(Job* job) {
+  free(job->cmd);
+  destroy_PIDList(&job->pid_list);
+}
+
+// Find a background job by its id. Returns NULL if there is no such job. The
+// pointer is only valid until the next job is added.
+static Job* lookup_job(int job_id) {
+  if (job_id < 1 || job_id > jobs.max_id || jobs.slots[job_id - 1].job_id == 0)
+    return NULL;
+
+  return &jobs.slots[job_id - 1];
+}
+
+// Give a job the next free id and copy it into the job table. Returns the copy
+// in the table.
+static Job* add_job(const Job* job) {
+  int job_id = jobs.max_id + 1;
+
+  if ((size_t) job_id > jobs.cap) {
+    size_t cap = (jobs.cap == 0) ? 16 : 2 * jobs.cap;
+    Job* slots = realloc(jobs.slots, cap * sizeof(Job));
+
+    if (slots == NULL) {
+      perror("ERROR: Failed to grow the job table");
+      abort();
+    }
+
+    for (size_t i = jobs.cap; i < cap; ++i)
+      slots[i].job_id = 0;
+
+    jobs.slots = slots;
+    jobs.cap = cap;
+  }
+
+  Job* slot = &jobs.slots[job_id - 1];
+
+  *slot = *job;
+  slot->job_id = job_id;
+  jobs.max_id = job_id;
+  ++jobs.len;
+
+  return slot;
+}
+
+// Take a job out of the job table and free what it owns. The ids above the
+// highest remaining job become free again.
+static void remove_job(Job* job) {
+  destroy_job(job);
+  job->job_id = 0;
+  --jobs.len;
+
+  while (jobs.max_id > 0 && jobs.slots[jobs.max_id - 1].job_id == 0)
+    --jobs.max_id;
+}
+
+// Orders finished jobs by id so completion notices come out like bash's
+static int compare_job_ids(const void* a, const void* b) {
+  return *(const int*) a - *(const int*) b;
+}
+
+// Charge the exit of a reaped process to its background job
+static void process_exited(pid_t pid) {
+  int* job_id = lookup_PIDIndex(&pid_index, pid);
+
+  // Foreground stages nobody waited on are reaped here too, they have no job
+  if (job_id != NULL) {
+    if (--lookup_job(*job_id)->running == 0)
+      push_back_JobIdDeque(&finished_jobs, *job_id);
+
+    remove_PIDIndex(&pid_index, pid);
+  }
+}
+
+// Reap every child that has exited since the last call and charge each exit to
+// its job. Jobs whose last process exited are queued on finished_jobs. The
+// process table is not touched at all unless a SIGCHLD arrived in the meantime.
+static void reap_children() {
+  struct signalfd_siginfo info;
+  bool exited = false;
+
+  // Standard signals do not queue, so one read may stand for many exits
+  while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info))
+    exited = true;
+
+  if (!exited && sigchld_fd != -1)
+    return;
+
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    process_exited(pid);
 }
 
 // Check the status of background jobs
@@ -82,70 +581,64 @@ void check_jobs_bg_status() {
   // Check on the statuses of all processes belonging to all background
   // jobs. This function should remove jobs from the jobs queue once all
   // processes belonging to a job have completed.
+  initialize_jobs();
 
+  reap_children();
 
-  int jobslength = (int)length_JobDeque(&jobs);
-  for(int j = 0; j < jobslength; j++) {
-    
-    // pop a job
-    Job tempJob = pop_front_JobDeque(&jobs);
-    
-    // Assume job is complete    
-    tempJob.isComplete = true;
-
+  if (is_empty_JobIdDeque(&finished_jobs))
+    return;
 
-    int pidlength = (int)length_PIDDeque(&tempJob.pid_list);
+  // Only the jobs that just finished are touched, never the whole table
+  size_t len = length_JobIdDeque(&finished_jobs);
+  int* finished = malloc(len * sizeof(int));
 
-    // Check the processes of the job to see if they're complete
-    for(int p = 0; p < pidlength; p++) {
-    
-      int status = 0;    
+  if (finished == NULL) {
+    perror("ERROR: Failed to allocate finished jobs");
+    exit(-1);
+  }
 
-      // check if process is complete
-      
-      // pop first process off of the temp job's process queue
-      pid_t tempProcess = pop_front_PIDDeque(&tempJob.pid_list);
+  pop_front_n_JobIdDeque(&finished_jobs, finished, len);
 
-      //  if(!(waitpid(tempProcess,&status,WNOHANG) != 0 && (WIFEXITED(status) 
-      //  || WIFSIGNALED(status))))
-      if(waitpid(tempProcess,&status,WNOHANG) == 0) {
+  qsort(finished, len, sizeof(int), compare_job_ids);
 
-        tempJob.isComplete = false;
-      }    
-    
-      // push process back to end of process queue
-      push_back_PIDDeque(&tempJob.pid_list, tempProcess);
-    }
+  for (size_t j = 0; j < len; j++) {
+    Job* job = lookup_job(finished[j]);
 
-    if(!(tempJob.isComplete)) {
-      push_back_JobDeque(&jobs, tempJob);
-    }
-    else {
-      // print that job is complete
-      print_job_bg_complete(tempJob.job_id, peek_front_PIDDeque(&tempJob.pid_list), tempJob.cmd); 
-      
-      // destroy PID list associated with specific job      
-      destroy_PIDDeque(&tempJob.pid_list);
-    }
+    print_job_bg_complete(job->job_id, pids_of_PIDList(&job->pid_list)[0], job->cmd);
   }
+
+  // Report every job with one write before the commands are freed
+  out_flush();
+
+  for (size_t j = 0; j < len; j++)
+    remove_job(lookup_job(finished[j]));
+
+  free(finished);
 }
 
 // Prints the job id number, the process id of the first process belonging to
 // the Job, and the command string associated with this job
 void print_job(int job_id, pid_t pid, const char* cmd) {
-  printf("[%d]\t%8d\t%s\n", job_id, pid, cmd);
-  fflush(stdout);
+  out_printf("[%d]\t%8d\t", job_id, pid);
+  out_str(cmd);
+  out_write("\n", 1);
 }
 
 // Prints a start up message for background processes
 void print_job_bg_start(int job_id, pid_t pid, const char* cmd) {
-  printf("Background job started: ");
+  out_str("Background job started: ");
   print_job(job_id, pid, cmd);
 }
 
 // Prints a completion message followed by the print job
 void print_job_bg_complete(int job_id, pid_t pid, const char* cmd) {
-  printf("Completed: \t");
+  out_str("Completed: \t");
+  print_job(job_id, pid, cmd);
+}
+
+// Prints a message for a foreground job that was stopped
+void print_job_stopped(int job_id, pid_t pid, const char* cmd) {
+  out_str("Stopped: \t");
   print_job(job_id, pid, cmd);
 }
 
@@ -158,14 +651,11 @@ void run_generic(GenericCommand cmd) {
   // Execute a program with a list of arguments. The `args` array is a NULL
   // terminated (last string is always NULL) list of strings. The first element
   // in the array is the executable
-  char* exec = cmd.args[0];
+  const char* exec = resolve_command(cmd.args[0]);
   char** args = cmd.args;
 
-  //(void) exec; // Silence unused variable warning
-  //(void) args; // Silence unused variable warning
-
-  // Implement run generic
-  execvp(exec, args);
+  if (exec != NULL)
+    execve(exec, args, environment());
 
   perror("ERROR: Failed to execute program");
 }
@@ -176,23 +666,67 @@ void run_echo(EchoCommand cmd) {
   // string is always NULL) list of strings.
   char** str = cmd.args;
 
-  // Remove warning silencers
-  // (void) str; // Silence unused variable warning
-
   // Implement echo
   if(*str != NULL) {
-    printf("%s", *str);
+    out_str(*str);
     str++;
     
     while(*str != NULL) {
-      printf(" %s", *str);
+      out_write(" ", 1);
+      out_str(*str);
       str++;
     }
   }
-  printf("\n");
+  out_write("\n", 1);
 
   // Flush the buffer before returning
-  fflush(stdout);
+  out_flush();
+}
+
+// Print the resolved program paths
+void run_hash(HashCommand cmd) {
+  // Only a plain `hash` prints, the other forms are run by quash
+  if (cmd.args[1] != NULL)
+    return;
+
+  if (!isCommandTableInit || is_empty_CommandTable(&command_table)) {
+    out_str("hash: hash table empty\n");
+  }
+  else {
+    out_str("hits\tcommand\n");
+
+    for (size_t i = 0; i < command_table.cap; ++i) {
+      CommandTableEntry* entry = &command_table.data[i];
+
+      if (entry->used) {
+        out_printf("%4d\t", entry->value.hits);
+        out_str(entry->value.path);
+        out_write("\n", 1);
+      }
+    }
+  }
+
+  out_flush();
+}
+
+// Reset the resolved program paths or resolve more programs
+void update_hash(HashCommand cmd) {
+  for (size_t i = 1; cmd.args[i] != NULL; ++i) {
+    const char* arg = cmd.args[i];
+
+    if (strcmp(arg, "-r") == 0) {
+      if (isCommandTableInit)
+        empty_CommandTable(&command_table);
+    }
+    else if (resolve_command(arg) == NULL) {
+      fprintf(stderr, "ERROR: hash: %s: not found\n", arg);
+      last_exit_status = 1;
+    }
+    else if (strchr(arg, '/') == NULL) {
+      // Looking a program up ahead of time is not a use of it
+      --lookup_CommandTable(&command_table, (char*) arg)->hits;
+    }
+  }
 }
 
 // Sets an environment variable
@@ -201,32 +735,42 @@ void run_export(ExportCommand cmd) {
   const char* env_var = cmd.env_var;
   const char* val = cmd.val;
 
-  // Remove warning silencers
-  //(void) env_var; // Silence unused variable warning
-  //(void) val;     // Silence unused variable warning
-
-  // Overwrite value set to 1, so will possibly overwrite existing definition
-  setenv(env_var, val, 1);
+  // Overwrites any existing definition
+  write_env(env_var, val);
 }
 
 // Changes the current working directory
 void run_cd(CDCommand cmd) {
   // Get the directory name
   const char* dir = cmd.dir;
+
+  // cd on its own goes home
+  if (dir == NULL && (dir = lookup_env("HOME")) == NULL) {
+    fprintf(stderr, "ERROR: HOME is not set\n");
+    last_exit_status = 1;
+    return;
+  }
+
   char* fulldir = realpath(dir, NULL);
 
   // Check if the directory is valid
   if (fulldir == NULL) {
     perror("ERROR: Failed to resolve path");
+    last_exit_status = 1;
     return;
   }
 
-  // Change directory, perhaps try without an error?
-  chdir(fulldir);
+  if (chdir(fulldir) == -1) {
+    perror("ERROR: Failed to change directory");
+    last_exit_status = 1;
+    free(fulldir);
+    return;
+  }
 
   //bool should_free = true;
   //char *PWD = get_current_directory(&should_free);
-  setenv("PWD", fulldir, 1);
+  write_env("PWD", fulldir);
+  invalidate_prompt();
 
   // free memory
   free(fulldir);
@@ -235,20 +779,63 @@ void run_cd(CDCommand cmd) {
   return;
 }
 
-// Sends a signal to all processes contained in a job
+// Send a signal to every process of a job. Returns false with errno set if it
+// could not be sent.
+static bool signal_job(Job* job, int signal) {
+  // Every process of the job shares one process group, so a single call
+  // reaches the whole pipeline
+  if (job_control)
+    return killpg(job->pgid, signal) == 0 || errno == ESRCH;
+
+  // Without job control that group is quash's own
+  pid_t* pids = pids_of_PIDList(&job->pid_list);
+
+  for (size_t i = 0; i < job->pid_list.len; ++i)
+    if (lookup_PIDIndex(&pid_index, pids[i]) != NULL &&
+        kill(pids[i], signal) == -1 && errno != ESRCH)
+      return false;
+
+  return true;
+}
+
 void run_kill(KillCommand cmd) {
   int signal = cmd.sig;
   int job_id = cmd.job;
 
-  // Remove warning silencers
-  //(void) signal; // Silence unused variable warning
-  //(void) job_id; // Silence unused variable warning
-
-  // Note: currently killing first process of first job, do I need to use job associated with job_id?
   // Kill all processes associated with a background job
-  Job jobToKill = peek_front_JobDeque(&jobs);
-  pid_t processToKill = peek_front_PIDDeque(&jobToKill.pid_list);
-  kill(processToKill, signal);
+  Job* jobToKill = lookup_job(job_id);
+
+  if (jobToKill == NULL) {
+    fprintf(stderr, "ERROR: No job with id %d\n", job_id);
+    last_exit_status = 1;
+    return;
+  }
+
+  if (!signal_job(jobToKill, signal)) {
+    perror("ERROR: Failed to signal job");
+    last_exit_status = 1;
+    return;
+  }
+
+  // A stopped job only sees the signal once it runs again
+  if (jobToKill->stopped && signal != SIGKILL) {
+    signal_job(jobToKill, SIGCONT);
+    jobToKill->stopped = false;
+  }
+
+  // SIGKILL cannot be caught, so the job is certainly ending. Reap it now so
+  // it is reported as completed before the next command runs.
+  if (signal == SIGKILL) {
+    pid_t* pids = pids_of_PIDList(&jobToKill->pid_list);
+
+    for (size_t i = 0; i < jobToKill->pid_list.len; ++i) {
+      int status;
+
+      if (lookup_PIDIndex(&pid_index, pids[i]) != NULL &&
+          waitpid(pids[i], &status, 0) == pids[i])
+        process_exited(pids[i]);
+    }
+  }
 }
 
 
@@ -256,35 +843,78 @@ void run_kill(KillCommand cmd) {
 void run_pwd() {
   char cwd[2000];
   getcwd(cwd, sizeof(cwd));
-  fprintf(stdout, "%s\n", cwd);
+  out_printf("%s\n", cwd);
 
   // Flush the buffer before returning
-  fflush(stdout);
+  out_flush();
 }
 
 // Prints all background jobs currently in the job list to stdout
 void run_jobs() {
 
-  // Note: does job need to be referenced here? Could i use size_t instead of int?
-  for(int x = 0; x < (int)length_JobDeque(&jobs); x++) {
-         
-    Job tempJob = pop_front_JobDeque(&jobs);
- 
-    print_job(tempJob.job_id, peek_front_PIDDeque(&tempJob.pid_list), tempJob.cmd);
+  // Job ids are dense, so walking the table by id lists jobs in order
+  for (int id = 1; id <= jobs.max_id; id++) {
+    Job* tempJob = lookup_job(id);
 
-    // Keep correct order of queue while printing 
-    push_back_JobDeque(&jobs, tempJob);
- 
-  } 
+    if (tempJob != NULL)
+      print_job(tempJob->job_id, pids_of_PIDList(&tempJob->pid_list)[0], tempJob->cmd);
+  }
 
   // Flush the buffer before returning
-  fflush(stdout);
+  out_flush();
 }
 
 /***************************************************************************
  * Functions for command resolution and process setup
  ***************************************************************************/
 
+// Open every pipe a job needs before any of its stages are started. Returns
+// false if the pipes could not be created.
+static bool new_PipeTable(const CommandHolder* holders, PipeTable* pipes) {
+  pipes->len = 0;
+
+  for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
+    if (holders[i].flags & PIPE_OUT)
+      ++pipes->len;
+
+  pipes->fds = NULL;
+
+  if (pipes->len == 0)
+    return true;
+
+  pipes->fds = malloc(pipes->len * sizeof(*pipes->fds));
+
+  if (pipes->fds == NULL) {
+    perror("ERROR: Failed to allocate pipes");
+    return false;
+  }
+
+  for (size_t i = 0; i < pipes->len; ++i) {
+    if (pipe2(pipes->fds[i], O_CLOEXEC) == -1) {
+      perror("ERROR: Failed to create pipe");
+
+      while (i-- > 0) {
+        close(pipes->fds[i][0]);
+        close(pipes->fds[i][1]);
+      }
+
+      free(pipes->fds);
+      pipes->fds = NULL;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Free a pipe table. The pipe ends themselves were already closed by
+// create_process() once the stage owning them was started.
+static void destroy_PipeTable(PipeTable* pipes) {
+  free(pipes->fds);
+  pipes->fds = NULL;
+  pipes->len = 0;
+}
+
 /**
  * @brief A dispatch function to resolve the correct @a Command variant
  * function for child processes.
@@ -316,6 +946,10 @@ void child_run_command(Command cmd) {
     run_jobs();
     break;
 
+  case HASH:
+    run_hash(cmd.hash);
+    break;
+
   case EXPORT:
   case CD:
   case KILL:
@@ -355,6 +989,10 @@ void parent_run_command(Command cmd) {
     run_kill(cmd.kill);
     break;
 
+  case HASH:
+    update_hash(cmd.hash);
+    break;
+
   case GENERIC:
   case ECHO:
   case PWD:
@@ -368,6 +1006,255 @@ void parent_run_command(Command cmd) {
   }
 }
 
+// Point fd at a newly opened file. The descriptor it referred to before is
+// stored in saved so restore_fd() can put it back. Returns false if the file
+// could not be opened.
+static bool redirect_fd(int fd, const char* path, int flags, int* saved) {
+  int file = open(path, flags | O_CLOEXEC, 0664);
+
+  if (file == -1) {
+    perror("ERROR: Failed to open redirect");
+    return false;
+  }
+
+  *saved = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  dup2(file, fd);
+  close(file);
+
+  return true;
+}
+
+// Undo redirect_fd()
+static void restore_fd(int fd, int saved) {
+  if (saved == -1)
+    return;
+
+  dup2(saved, fd);
+  close(saved);
+}
+
+/**
+ * @brief Run a builtin that is not part of a pipeline inside quash
+ *
+ * Nothing reads from or writes to such a builtin except through its
+ * redirects, so there is no need for a process of its own. The redirects are
+ * applied to quash's own standard in and out and undone afterwards.
+ *
+ * @param holder The CommandHolder holding a builtin
+ *
+ * @sa create_process
+ */
+static void run_builtin(CommandHolder holder) {
+  int saved_in = -1;
+  int saved_out = -1;
+  bool ok = true;
+
+  if (holder.flags & REDIRECT_IN)
+    ok = redirect_fd(STDIN_FILENO, holder.redirect_in, O_RDONLY, &saved_in);
+
+  if (ok && (holder.flags & REDIRECT_OUT)) {
+    int mode = (holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC;
+
+    ok = redirect_fd(STDOUT_FILENO, holder.redirect_out,
+                     O_CREAT | O_WRONLY | mode, &saved_out);
+  }
+
+  // Builtins only set the status when they fail
+  last_exit_status = ok ? 0 : 1;
+
+  if (ok) {
+    child_run_command(holder.cmd);
+    parent_run_command(holder.cmd);
+  }
+
+  // Builtins flush their own output, this only guards the redirect target
+  out_flush();
+
+  restore_fd(STDOUT_FILENO, saved_out);
+  restore_fd(STDIN_FILENO, saved_in);
+}
+
+/**
+ * @brief Launch a @a GenericCommand with posix_spawn() instead of forking the
+ * whole quash process
+ *
+ * The pipe and redirect flags of the holder are translated into spawn file
+ * actions so the child is set up exactly like the fork based path would set it
+ * up, but without copying quash's page tables first.
+ *
+ * @param holder The CommandHolder holding a @a GenericCommand
+ *
+ * @param pipe_in Read end of the pipe feeding this stage or -1
+ *
+ * @param pipe_out Write end of the pipe this stage feeds or -1
+ *
+ * @param pgid Process group to join or 0 to start a new one. Ignored without
+ * job control.
+ *
+ * @return The process id of the new process or -1 if it could not be started
+ *
+ * @sa create_process
+ */
+static pid_t spawn_generic(CommandHolder holder, int pipe_in, int pipe_out,
+                           pid_t pgid) {
+  char** args = holder.cmd.generic.args;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  pid_t pid;
+  int err;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+
+  // Quash blocks SIGCHLD for its signalfd, programs should not inherit that
+  posix_spawnattr_setsigmask(&attr, &child_sigmask);
+  posix_spawnattr_setsigdefault(&attr, &child_sigdefault);
+
+  if (job_control) {
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                             POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    // Take the terminal in the child too, before it can read from it. Quash
+    // does the same from its side once the process exists.
+    if (!(holder.flags & BACKGROUND))
+      posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+  }
+  else {
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                             POSIX_SPAWN_SETSIGDEF);
+  }
+
+  // The table's pipe ends are close-on-exec, only the duplicates survive
+  if (holder.flags & PIPE_IN)
+    posix_spawn_file_actions_adddup2(&actions, pipe_in, STDIN_FILENO);
+
+  if (holder.flags & PIPE_OUT)
+    posix_spawn_file_actions_adddup2(&actions, pipe_out, STDOUT_FILENO);
+
+  if (holder.flags & REDIRECT_IN)
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                     holder.redirect_in, O_RDONLY, 0);
+
+  if (holder.flags & REDIRECT_OUT) {
+    int mode = (holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC;
+
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                     holder.redirect_out,
+                                     O_CREAT | O_WRONLY | mode, 0664);
+  }
+
+  const char* path = resolve_command(args[0]);
+
+  err = path != NULL ? posix_spawn(&pid, path, &actions, &attr, args,
+                                         environment())
+                     : errno;
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  // A program deleted since it was found is searched for again next time
+  if (err == ENOENT && path != NULL)
+    forget_command(args[0]);
+
+  if (err != 0) {
+    errno = err;
+    perror("ERROR: Failed to execute program");
+    return -1;
+  }
+
+  return pid;
+}
+
+/**
+ * @brief Start the process of a builtin in a pipeline or in the background
+ * without forking quash
+ *
+ * The builtin runs in quash with its output captured, since it only prints
+ * what quash already knows. The zygote then starts a process that joins the
+ * job and writes that output where the builtin's standard out goes.
+ *
+ * @param holder The builtin and its redirects
+ *
+ * @param pipe_in Read end of the pipe feeding this stage or -1
+ *
+ * @param pipe_out Write end of the pipe this stage feeds or -1
+ *
+ * @param job The job the process belongs to
+ *
+ * @return The process id of the new process, -1 if it could not be started or
+ * 0 if there is no zygote to start it
+ */
+static pid_t spawn_builtin(CommandHolder holder, int pipe_in, int pipe_out,
+                           Job* job) {
+  if (!zygote_running())
+    return 0;
+
+  // A copy of quash it forked would not print before quash announces the job.
+  // The process is held back until open_gate() instead.
+  if (job->gate[0] == -1 && pipe2(job->gate, O_CLOEXEC) == -1) {
+    perror("ERROR: Failed to create pipe");
+    return -1;
+  }
+
+  int fd_in  = (holder.flags & PIPE_IN)  ? pipe_in  : -1;
+  int fd_out = (holder.flags & PIPE_OUT) ? pipe_out : -1;
+  int redirect_in = -1;
+  int redirect_out = -1;
+
+  // Files are opened here instead of in the child, relative to quash's
+  // working directory
+  if (holder.flags & REDIRECT_IN) {
+    redirect_in = open(holder.redirect_in, O_RDONLY | O_CLOEXEC);
+
+    if (redirect_in == -1) {
+      perror("ERROR: Failed to open redirect");
+      return -1;
+    }
+
+    fd_in = redirect_in;
+  }
+
+  if (holder.flags & REDIRECT_OUT) {
+    int mode = (holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC;
+
+    redirect_out = open(holder.redirect_out,
+                        O_CREAT | O_WRONLY | O_CLOEXEC | mode, 0664);
+
+    if (redirect_out == -1) {
+      perror("ERROR: Failed to open redirect");
+
+      if (redirect_in != -1)
+        close(redirect_in);
+
+      return -1;
+    }
+
+    fd_out = redirect_out;
+  }
+
+  size_t len;
+  char* output;
+
+  out_capture_begin();
+  child_run_command(holder.cmd);
+  output = out_capture_end(&len);
+
+  pid_t pid = zygote_launch(job->pgid, fd_in, fd_out, job->gate[0], output,
+                            len);
+
+  if (pid == -1)
+    perror("ERROR: Failed to start builtin");
+
+  free(output);
+
+  if (redirect_in != -1)
+    close(redirect_in);
+  if (redirect_out != -1)
+    close(redirect_out);
+
+  return pid;
+}
+
 /**
  * @brief Creates one new process centered around the @a Command in the @a
  * CommandHolder setting up redirects and pipes where needed
@@ -381,9 +1268,20 @@ void parent_run_command(Command cmd) {
  *
  * @param holder The CommandHolder to try to run
  *
+ * @param job The Job the new process belongs to
+ *
+ * @param pipe_in Read end of the pipe feeding this stage or -1. It is closed in
+ * quash once the child owns it.
+ *
+ * @param pipe_out Write end of the pipe this stage feeds or -1. It is closed in
+ * quash once the child owns it.
+ *
+ * @return The process id of the new process, 0 if the command ran inside quash
+ * or -1 if it could not be started
+ *
  * @sa Command CommandHolder
  */
-void create_process(CommandHolder holder, Job* job) {
+pid_t create_process(CommandHolder holder, Job* job, int pipe_in, int pipe_out) {
   // Read the flags field from the parser
   bool p_in  = holder.flags & PIPE_IN;
   bool p_out = holder.flags & PIPE_OUT;
@@ -392,35 +1290,83 @@ void create_process(CommandHolder holder, Job* job) {
   bool r_app = holder.flags & REDIRECT_APPEND; // This can only be true if r_out
                                                // is true
 
-  // TODO: Remove warning silencers
-  //(void) p_in;  // Silence unused variable warning
-  //(void) p_out; // Silence unused variable warning
-  //(void) r_in;  // Silence unused variable warning
-  //(void) r_out; // Silence unused variable warning
-  //(void) r_app; // Silence unused variable warning
-  
-  // fork process
-  pid_t pid_1 = fork(); 
+  // Programs are launched without duplicating quash. Builtins that print from
+  // a process of their own get one from the zygote, or from a real fork below
+  // if there is no zygote.
+  if (get_command_holder_type(holder) == GENERIC) {
+    pid_t pid = spawn_generic(holder, pipe_in, pipe_out, job->pgid);
+
+    if (pid > 0) {
+      push_PIDList(&job->pid_list, pid);
+
+      if (job->pgid == 0)
+        job->pgid = pid;
+    }
+
+    if (p_in)
+      close(pipe_in);
+    if (p_out)
+      close(pipe_out);
+
+    return pid;
+  }
+
+  // A builtin on its own does not need a process. Background builtins still
+  // get one so they are reported like any other job.
+  if (!p_in && !p_out && !(holder.flags & BACKGROUND)) {
+    run_builtin(holder);
+    return 0;
+  }
 
-  // push process onto job's pid list, **check that passing by reference works
-  // NOTE: Look into why this ampersand helps, C thing??
-  push_back_PIDDeque(&job->pid_list, pid_1); 
+  // The child would write out anything still buffered a second time
+  out_flush();
+  fflush(stdout);
+
+  pid_t pid = spawn_builtin(holder, pipe_in, pipe_out, job);
+
+  if (pid != 0) {
+    if (pid > 0) {
+      if (job->pgid == 0)
+        job->pgid = pid;
+
+      setpgid(pid, job->pgid);
+      push_PIDList(&job->pid_list, pid);
+    }
+
+    if (p_in)
+      close(pipe_in);
+    if (p_out)
+      close(pipe_out);
+
+    parent_run_command(holder.cmd);
+
+    return pid;
+  }
+
+  // Without a zygote quash forks itself
+  pid_t pid_1 = fork(); 
 
   // check if process is a child process
   if (pid_1 == 0) {
+    // Join the job's process group. Quash does the same from its side so
+    // neither order of execution leaves a gap.
+    setpgid(0, job->pgid);
+    signal(SIGTTOU, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &child_sigmask, NULL);
+
     if(p_in) {
       // open pipe for reading
-      dup2(p1[0], STDIN_FILENO);
+      dup2(pipe_in, STDIN_FILENO);
 
       // close the pipe NOTE: does it make a difference to close outside of this if
-      close(p1[0]);
+      close(pipe_in);
     }
     if(p_out) {
       // open pipe for writing
-      dup2(p1[1], STDOUT_FILENO);
+      dup2(pipe_out, STDOUT_FILENO);
 
       // close the pipe NOTE: does it make a difference to close outside of this if
-      close(p1[1]);
+      close(pipe_out);
     }
     if(r_in) {
       int fileDescriptor = open(holder.redirect_in, O_RDONLY, 0); // is mode 0 read only?
@@ -451,74 +1397,260 @@ void create_process(CommandHolder holder, Job* job) {
   }
   // parent process
   else {
-    // close(p1[0]);
-    // close(p1[1]);
+    // The child owns its pipe ends now. Keeping them open here would stop the
+    // neighbouring stages from ever seeing EOF.
+    if (p_in)
+      close(pipe_in);
+    if (p_out)
+      close(pipe_out);
+
+    if (pid_1 > 0) {
+      if (job->pgid == 0)
+        job->pgid = pid_1;
+
+      setpgid(pid_1, job->pgid);
+      push_PIDList(&job->pid_list, pid_1);
+    }
+    parent_run_command(holder.cmd);
+  }
 
-    push_back_PIDDeque(&job->pid_list, pid_1);
-    parent_run_command(holder.cmd); 
-   
+  return pid_1;
+}
 
-    // why not exit?
+// Let the builtin processes of a job write their output
+static void open_gate(Job* job) {
+  if (job->gate[0] == -1)
+    return;
+
+  close(job->gate[0]);
+  close(job->gate[1]);
+  job->gate[0] = job->gate[1] = -1;
+}
+
+// Block until every process of a foreground job has exited or one of them was
+// stopped. One waitid() loop collects the stages in whatever order they
+// finish. Without job control the job shares quash's process group with
+// background jobs and the zygote, so any child may turn up and the ones of
+// other jobs are charged to those. Returns the exit status of the last stage,
+// or 128 plus the signal with *stopped set if the job was stopped.
+static int wait_foreground_job(Job* job, bool* stopped) {
+  size_t remaining = job->pid_list.len;
+  pid_t last = pids_of_PIDList(&job->pid_list)[remaining - 1];
+  int status = 0;
+  siginfo_t info;
+
+  // Only a job that has the terminal can be stopped from it
+  int options = job_control ? (WEXITED | WSTOPPED) : WEXITED;
+
+  *stopped = false;
+
+  while (remaining > 0) {
+    if (waitid(P_ALL, 0, &info, options) == -1) {
+      if (errno == EINTR)
+        continue;
+
+      perror("ERROR: Failed to wait for job");
+      break;
+    }
+
+    bool exited = info.si_code != CLD_STOPPED && info.si_code != CLD_TRAPPED;
+
+    if (!contains_PIDList(&job->pid_list, info.si_pid)) {
+      // Processes of a job stopped earlier may report stopping late
+      if (exited)
+        process_exited(info.si_pid);
+
+      continue;
+    }
+
+    // Ctrl-Z stops the whole process group. Quash takes the terminal back
+    // after the first process reports it instead of waiting for the rest.
+    if (!exited) {
+      *stopped = true;
+      return 128 + info.si_status;
+    }
+
+    --remaining;
+
+    if (info.si_pid == last) {
+      if (info.si_code == CLD_EXITED)
+        status = info.si_status;
+      else
+        status = 128 + info.si_status; // Killed by a signal
+    }
   }
 
+  return status;
 }
 
-// Run a list of commands
-void run_script(CommandHolder* holders) {
-  if (holders == NULL)
-    return;
+// Move a stopped foreground job into the job table so it is listed and can be
+// killed. Its processes that already exited are not indexed, since they were
+// reaped while quash waited for the job.
+static void add_stopped_job(Job* job, const CommandHolder* holders) {
+  job->cmd = stringify_pipeline(holders);
+  job->running = 0;
+  job->stopped = true;
 
-  // initialize jobs queue
-  if(!isJobDequeInit) {
-    jobs = new_JobDeque(10); // set initial size of Job Deque to 10  
-    isJobDequeInit = true;
+  Job* stopped_job = add_job(job);
+  pid_t* pids = pids_of_PIDList(&stopped_job->pid_list);
+
+  for (size_t i = 0; i < stopped_job->pid_list.len; ++i) {
+    siginfo_t info;
+
+    // Only a child that was not reaped yet can still be looked at
+    if (waitid(P_PID, pids[i], &info, WEXITED | WNOHANG | WNOWAIT) == 0) {
+      insert_PIDIndex(&pid_index, pids[i], stopped_job->job_id);
+      ++stopped_job->running;
+    }
   }
 
-  check_jobs_bg_status();
+  // The terminal echoed ^Z without ending the line
+  out_write("\n", 1);
+  print_job_stopped(stopped_job->job_id, pids[0], stopped_job->cmd);
+  out_flush();
+}
 
+/**
+ * @brief Run one pipeline of a command list
+ *
+ * A foreground pipeline is waited for and leaves its status in @a
+ * last_exit_status. A background pipeline becomes a job and counts as a
+ * success.
+ *
+ * @param holders The first command of the pipeline
+ *
+ * @return False if the pipeline was `exit` and nothing else should run
+ */
+static bool run_pipeline(CommandHolder* holders) {
   if (get_command_holder_type(holders[0]) == EXIT &&
       get_command_holder_type(holders[1]) == EOC) {
     end_main_loop();
-    return;
+    return false;
   }
 
   CommandType type;
 
   Job job;
-  job.cmd = get_command_string();
-  job.pid_list = new_PIDDeque(10); // set initial size of PIE Deque at 10 
+  job.cmd = NULL; // only copied if the job goes to the background
+  job.pid_list = new_PIDList(); // only allocates for long pipelines
+  job.pgid = job_control ? 0 : getpgrp(); // 0 is set by the first process
+  job.gate[0] = job.gate[1] = -1; // only created for builtin processes
+  job.stopped = false;
+
+  // Every pipe is created up front so all stages stream concurrently
+  PipeTable pipes;
+
+  if (!new_PipeTable(holders, &pipes)) {
+    last_exit_status = 1;
+    return true;
+  }
 
-  int status = 0;
+  pid_t last = 0;
+
+  // Run all commands in the `holder` array. Stage i reads from pipe i - 1 and
+  // writes to pipe i.
+  for (int i = 0; (type = get_command_holder_type(holders[i])) != EOC; ++i) {
+    int pipe_in  = (holders[i].flags & PIPE_IN)  ? pipes.fds[i - 1][0] : -1;
+    int pipe_out = (holders[i].flags & PIPE_OUT) ? pipes.fds[i][1]     : -1;
+
+    last = create_process(holders[i], &job, pipe_in, pipe_out);
+  }
+
+  destroy_PipeTable(&pipes);
+
+  if (!(holders[0].flags & BACKGROUND) || job.pid_list.len == 0) {
+    open_gate(&job);
+
+    // Run foreground job. A background job whose programs all failed to
+    // launch has nothing to track and is cleaned up here as well.
+    if(job.pid_list.len != 0) {
+      bool stopped;
+
+      // The job owns the terminal while it runs so ctrl-c reaches it and not
+      // quash
+      if (job_control)
+        tcsetpgrp(STDIN_FILENO, job.pgid);
+
+      last_exit_status = wait_foreground_job(&job, &stopped);
 
-  // Run all commands in the `holder` array
-  for (int i = 0; (type = get_command_holder_type(holders[i])) != EOC; ++i)
-    create_process(holders[i], &job);
+      if (job_control)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
 
-  if (!(holders[0].flags & BACKGROUND)) {
-    // Run foreground job
-    if(!is_empty_PIDDeque(&job.pid_list)) {
-      waitpid(peek_front_PIDDeque(&job.pid_list), &status, 0);
+      // The job table owns the pid list of a stopped job from now on
+      if (stopped) {
+        add_stopped_job(&job, holders);
+        return true;
+      }
     }
+
+    // Like other shells, a last stage that could not be started fails the
+    // pipeline with 127
+    if (last == -1)
+      last_exit_status = 127;
     
     // free memory
-    free(job.cmd);
-    destroy_PIDDeque(&job.pid_list);
+    destroy_PIDList(&job.pid_list);
   }
   else {
     // A background job.
 
-    // Set the job id for our new job
-    if(is_empty_JobDeque(&jobs)) {
-      job.job_id = 1;
-    }
-    else {
-      // check if need to pass as a reference
-      job.job_id = peek_back_JobDeque(&jobs).job_id + 1;    
-    }
+    job.cmd = stringify_pipeline(holders);
+    job.running = job.pid_list.len;
+
+    // Set the job id for our new job and put it in the job table
+    Job* bg_job = add_job(&job);
+
+    // Index every process so its exit can be charged to this job directly
+    pid_t* pids = pids_of_PIDList(&bg_job->pid_list);
+
+    for (size_t i = 0; i < bg_job->pid_list.len; ++i)
+      insert_PIDIndex(&pid_index, pids[i], bg_job->job_id);
+
+    print_job_bg_start(bg_job->job_id, pids[0], bg_job->cmd);
+    out_flush();
+    open_gate(bg_job);
+
+    last_exit_status = 0;
+  }
+
+  return true;
+}
+
+// Find the end of pipeline marker of the pipeline starting at holders
+static CommandHolder* end_of_pipeline(CommandHolder* holders) {
+  while (get_command_holder_type(*holders) != EOC)
+    ++holders;
+
+  return holders;
+}
+
+// Run a list of commands
+void run_script(CommandHolder* holders) {
+  if (holders == NULL)
+    return;
+
+  initialize_jobs();
+
+  CommandHolder* pipeline = holders;
+
+  while (true) {
+    // Expanded only now so the pipelines before it have set the environment
+    expand_pipeline_env(pipeline);
+
+    if (!run_pipeline(pipeline))
+      break;
+
+    CommandHolder* eoc = end_of_pipeline(pipeline);
+
+    // Skip the pipelines && and || cut short. The status they test stays the
+    // one of the last pipeline that ran, so `a && b || c` runs c if a fails.
+    while ((eoc->cmd.eoc.next == LIST_AND && last_exit_status != 0) ||
+           (eoc->cmd.eoc.next == LIST_OR && last_exit_status == 0))
+      eoc = end_of_pipeline(eoc + 1);
 
-    // Push our job onto the job queue
-    push_back_JobDeque(&jobs, job);
+    if (eoc->cmd.eoc.next == LIST_END)
+      break;
 
-    print_job_bg_start(job.job_id, peek_front_PIDDeque(&job.pid_list), job.cmd);
+    pipeline = eoc + 1;
   }
 }
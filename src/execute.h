@@ -31,6 +31,12 @@ const char* lookup_env(const char* env_var);
  */
 void write_env(const char* env_var, const char* val);
 
+/**
+ * @brief Free the table @a lookup_env() and @a write_env() keep the
+ * environment in
+ */
+void destroy_env();
+
 /**
  * @brief Get the real current working directory
  *
@@ -55,6 +61,11 @@ void check_jobs_bg_status();
  * We use the minimum of what a Job structure should contain to pass to this
  * function.
  *
+ * @note The line is queued with @a out_write() and the caller has to call @a
+ * out_flush() while @a cmd is still valid. The same holds for @a
+ * print_job_bg_start(), @a print_job_bg_complete() and @a
+ * print_job_stopped().
+ *
  * @param job_id Job identifier number.
  *
  * @param pid Process id of a process belonging to this job.
@@ -92,6 +103,19 @@ void print_job_bg_start(int job_id, pid_t pid, const char* cmd);
  */
 void print_job_bg_complete(int job_id, pid_t pid, const char* cmd);
 
+/**
+ * @brief Print that a foreground job was stopped and kept as a job to standard
+ * out
+ *
+ * @param job_id Job identifier number.
+ *
+ * @param pid Process id of a process belonging to this job.
+ *
+ * @param cmd String holding an aproximation of what the user typed in for the
+ * command.
+ */
+void print_job_stopped(int job_id, pid_t pid, const char* cmd);
+
 /**
  * @brief Run a generic (non-builtin) command
  *
@@ -151,6 +175,29 @@ void run_pwd();
  */
 void run_jobs();
 
+/**
+ * @brief Print the table of resolved program paths for the builtin hash
+ * command
+ *
+ * This only does something for a plain `hash`. The forms that change the table
+ * are handled by @a update_hash() in quash itself.
+ *
+ * @param cmd HashCommand to run
+ *
+ * @sa HashCommand
+ */
+void run_hash(HashCommand cmd);
+
+/**
+ * @brief Forget every resolved program path for `hash -r` or resolve the
+ * programs named by `hash name...`
+ *
+ * @param cmd HashCommand to run
+ *
+ * @sa HashCommand
+ */
+void update_hash(HashCommand cmd);
+
 /**
  * @brief Common entry point for all commands
  *
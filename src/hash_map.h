@@ -0,0 +1,305 @@
+/**
+ * @file hash_map.h
+ *
+ * @brief Open addressing hash map generators specialized to any given key and
+ * value type.
+ */
+
+#ifndef SRC_HASH_MAP_H
+#define SRC_HASH_MAP_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Hash function for integer keys such as process ids
+ *
+ * The map masks the low bits of the hash so the key is mixed first. Otherwise
+ * consecutive pids would fill consecutive slots and lengthen probe sequences.
+ *
+ * @param key Integer to hash
+ *
+ * @return Hash of @a key
+ */
+static inline size_t hash_int(int key) {
+  uint64_t x = (uint32_t) key;
+
+  x ^= x >> 16;
+  x *= 0x45d9f3bULL;
+  x ^= x >> 16;
+  x *= 0x45d9f3bULL;
+  x ^= x >> 16;
+
+  return (size_t) x;
+}
+
+/**
+ * @brief Equality function for integer keys
+ */
+static inline bool equals_int(int a, int b) {
+  return a == b;
+}
+
+/**
+ * @brief Hash function for NUL terminated string keys (FNV-1a)
+ *
+ * @param key String to hash
+ *
+ * @return Hash of @a key
+ */
+static inline size_t hash_str(const char* key) {
+  uint64_t x = 0xcbf29ce484222325ULL;
+
+  for (; *key != '\0'; ++key) {
+    x ^= (unsigned char) *key;
+    x *= 0x100000001b3ULL;
+  }
+
+  return (size_t) x;
+}
+
+/**
+ * @brief Equality function for NUL terminated string keys
+ */
+static inline bool equals_str(const char* a, const char* b) {
+  return strcmp(a, b) == 0;
+}
+
+/**
+ * @def IMPLEMENT_HASH_MAP_STRUCT(struct_name, key_type, value_type)
+ *
+ * @brief Generates a structure for use with hash maps.
+ *
+ * Follow this call with @a IMPLEMENT_HASH_MAP() to generate the functions
+ * that correspond to this structure. The structure fields may be read to iterate over the map (every
+ * slot of `data` with `used` set holds an entry) but should only be modified
+ * through the generated functions.
+ *
+ * @param struct_name The name of the structure
+ *
+ * @param key_type The type of the keys stored in the @a struct_name structure
+ *
+ * @param value_type The type of the values stored in the @a struct_name
+ * structure
+ *
+ * @sa IMPLEMENT_HASH_MAP
+ */
+#define IMPLEMENT_HASH_MAP_STRUCT(struct_name, key_type, value_type)    \
+  typedef struct struct_name##Entry {                                   \
+    key_type key;                                                       \
+    value_type value;                                                   \
+    bool used;                                                          \
+  } struct_name##Entry;                                                 \
+                                                                        \
+  typedef struct struct_name {                                          \
+    struct_name##Entry* data;                                           \
+    size_t cap;                                                         \
+    size_t len;                                                         \
+                                                                        \
+    void (*destructor)(key_type, value_type);                           \
+  } struct_name;
+
+/**
+ * @def IMPLEMENT_HASH_MAP(struct_name, key_type, value_type, hash, equals)
+ *
+ * @brief Generates a @a malloc based set of functions for use with a structure
+ * generated by @a IMPLEMENT_HASH_MAP_STRUCT()
+ *
+ * The map uses linear probing over a power of two sized table that is kept at
+ * most three quarters full. Removal shifts the following entries of the probe
+ * sequence back instead of leaving tombstones, so lookups never slow down as
+ * entries come and go.
+ *
+ * @param struct_name The name of the structure
+ *
+ * @param key_type The type of the keys stored in the @a struct_name structure
+ *
+ * @param value_type The type of the values stored in the @a struct_name
+ * structure
+ *
+ * @param hash A function taking a @a key_type and returning a size_t hash
+ *
+ * @param equals A function taking two @a key_type values and returning true if
+ * they are the same key
+ *
+ * @sa IMPLEMENT_HASH_MAP_STRUCT()
+ */
+#define IMPLEMENT_HASH_MAP(struct_name, key_type, value_type, hash, equals) \
+                                                                        \
+  static inline struct_name##Entry*                                     \
+  __alloc_##struct_name(size_t cap) {                                   \
+    struct_name##Entry* data =                                          \
+      (struct_name##Entry*) calloc(cap, sizeof(struct_name##Entry));    \
+                                                                        \
+    if (data == NULL) {                                                 \
+      fprintf(stderr, "ERROR: Failed to allocate " #struct_name         \
+              " contents\n");                                           \
+      exit(-1);                                                         \
+    }                                                                   \
+                                                                        \
+    return data;                                                        \
+  }                                                                     \
+                                                                        \
+  static inline struct_name new_##struct_name(size_t init_cap) {        \
+    struct_name ret;                                                    \
+                                                                        \
+    ret.cap = 8;                                                        \
+    while (ret.cap < init_cap)                                          \
+      ret.cap <<= 1;                                                    \
+                                                                        \
+    ret.data = __alloc_##struct_name(ret.cap);                          \
+    ret.len = 0;                                                        \
+    ret.destructor = NULL;                                              \
+                                                                        \
+    return ret;                                                         \
+  }                                                                     \
+                                                                        \
+  static inline struct_name                                             \
+  new_destructable_##struct_name(size_t init_cap,                       \
+                                 void (*destructor)(key_type,           \
+                                                    value_type)) {      \
+    struct_name ret = new_##struct_name(init_cap);                      \
+    ret.destructor = destructor;                                        \
+    return ret;                                                         \
+  }                                                                     \
+                                                                        \
+  static inline void empty_##struct_name(struct_name* map) {            \
+    assert(map != NULL);                                                \
+    assert(map->data != NULL); /* Make sure the structure is valid */   \
+                                                                        \
+    for (size_t i = 0; i < map->cap; ++i) {                             \
+      if (map->data[i].used && map->destructor != NULL)                 \
+        map->destructor(map->data[i].key, map->data[i].value);          \
+                                                                        \
+      map->data[i].used = false;                                        \
+    }                                                                   \
+                                                                        \
+    map->len = 0;                                                       \
+  }                                                                     \
+                                                                        \
+  static inline void destroy_##struct_name(struct_name* map) {          \
+    assert(map != NULL);                                                \
+                                                                        \
+    if (map->data == NULL)                                              \
+      return;                                                           \
+                                                                        \
+    empty_##struct_name(map);                                           \
+    free(map->data);                                                    \
+                                                                        \
+    map->data = NULL;                                                   \
+    map->cap = map->len = 0;                                            \
+  }                                                                     \
+                                                                        \
+  static inline bool is_empty_##struct_name(struct_name* map) {         \
+    assert(map != NULL);                                                \
+    assert(map->data != NULL); /* Make sure the structure is valid */   \
+    return map->len == 0;                                               \
+  }                                                                     \
+                                                                        \
+  static inline size_t length_##struct_name(struct_name* map) {         \
+    assert(map != NULL);                                                \
+    assert(map->data != NULL); /* Make sure the structure is valid */   \
+    return map->len;                                                    \
+  }                                                                     \
+                                                                        \
+  /* Index of the slot holding key or of the empty slot ending its probe */ \
+  static inline size_t                                                  \
+  __find_##struct_name(struct_name* map, key_type key) {                \
+    size_t mask = map->cap - 1;                                         \
+    size_t i = hash(key) & mask;                                        \
+                                                                        \
+    while (map->data[i].used && !equals(map->data[i].key, key))         \
+      i = (i + 1) & mask;                                               \
+                                                                        \
+    return i;                                                           \
+  }                                                                     \
+                                                                        \
+  static inline void __on_insert_##struct_name(struct_name* map) {      \
+    if (4 * (map->len + 1) <= 3 * map->cap)                             \
+      return;                                                           \
+                                                                        \
+    struct_name##Entry* old_data = map->data;                           \
+    size_t old_cap = map->cap;                                          \
+                                                                        \
+    map->cap = 2 * old_cap;                                             \
+    map->data = __alloc_##struct_name(map->cap);                        \
+                                                                        \
+    for (size_t i = 0; i < old_cap; ++i)                                \
+      if (old_data[i].used)                                             \
+        map->data[__find_##struct_name(map, old_data[i].key)] =         \
+          old_data[i];                                                  \
+                                                                        \
+    free(old_data);                                                     \
+  }                                                                     \
+                                                                        \
+  static inline value_type*                                             \
+  lookup_##struct_name(struct_name* map, key_type key) {                \
+    assert(map != NULL);                                                \
+    assert(map->data != NULL); /* Make sure the structure is valid */   \
+                                                                        \
+    size_t i = __find_##struct_name(map, key);                          \
+                                                                        \
+    return map->data[i].used ? &map->data[i].value : NULL;              \
+  }                                                                     \
+                                                                        \
+  static inline void insert_##struct_name(struct_name* map, key_type key, \
+                                          value_type value) {           \
+    assert(map != NULL);                                                \
+    assert(map->data != NULL); /* Make sure the structure is valid */   \
+                                                                        \
+    __on_insert_##struct_name(map);                                     \
+                                                                        \
+    size_t i = __find_##struct_name(map, key);                          \
+                                                                        \
+    if (map->data[i].used) {                                            \
+      if (map->destructor != NULL)                                      \
+        map->destructor(map->data[i].key, map->data[i].value);          \
+    }                                                                   \
+    else {                                                              \
+      ++map->len;                                                       \
+    }                                                                   \
+                                                                        \
+    map->data[i] = (struct_name##Entry) { key, value, true };           \
+  }                                                                     \
+                                                                        \
+  static inline bool remove_##struct_name(struct_name* map, key_type key) { \
+    assert(map != NULL);                                                \
+    assert(map->data != NULL); /* Make sure the structure is valid */   \
+                                                                        \
+    size_t mask = map->cap - 1;                                         \
+    size_t i = __find_##struct_name(map, key);                          \
+                                                                        \
+    if (!map->data[i].used)                                             \
+      return false;                                                     \
+                                                                        \
+    if (map->destructor != NULL)                                        \
+      map->destructor(map->data[i].key, map->data[i].value);            \
+                                                                        \
+    /* Shift back every entry that probed past the freed slot */        \
+    size_t j = i;                                                       \
+                                                                        \
+    while (true) {                                                      \
+      j = (j + 1) & mask;                                               \
+                                                                        \
+      if (!map->data[j].used)                                           \
+        break;                                                          \
+                                                                        \
+      size_t home = hash(map->data[j].key) & mask;                      \
+                                                                        \
+      if (((j - home) & mask) >= ((j - i) & mask)) {                    \
+        map->data[i] = map->data[j];                                    \
+        i = j;                                                          \
+      }                                                                 \
+    }                                                                   \
+                                                                        \
+    map->data[i].used = false;                                          \
+    --map->len;                                                         \
+                                                                        \
+    return true;                                                        \
+  }
+
+#endif //SRC_HASH_MAP_H
@@ -0,0 +1,204 @@
+/**
+ * @file output.c
+ *
+ * @brief Implements the buffered standard out used by builtin commands
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Pieces shorter than this are copied into the buffer instead of referenced
+#define OUT_COPY_MAX (64)
+
+#define OUT_BUF_SIZE (4096)
+#define OUT_IOV_MAX  (64)
+
+static char buf[OUT_BUF_SIZE];
+static size_t buf_len = 0;
+
+static struct iovec iov[OUT_IOV_MAX];
+static int iov_len = 0;
+
+// Output gathered between out_capture_begin() and out_capture_end()
+static bool capturing = false;
+static char* capture = NULL;
+static size_t capture_len = 0;
+static size_t capture_cap = 0;
+
+// Make room for len more bytes of captured output and return where they go
+static char* __capture_reserve(size_t len) {
+  if (capture_len + len > capture_cap) {
+    size_t cap = (capture_cap == 0) ? OUT_BUF_SIZE : 2 * capture_cap;
+
+    while (cap < capture_len + len)
+      cap *= 2;
+
+    char* grown = realloc(capture, cap);
+
+    if (grown == NULL) {
+      perror("ERROR: Failed to capture output");
+      exit(-1);
+    }
+
+    capture = grown;
+    capture_cap = cap;
+  }
+
+  return capture + capture_len;
+}
+
+// Write all queued pieces, picking up after partial writes. While capturing
+// they are appended to the capture instead.
+void out_flush() {
+  if (capturing) {
+    for (int i = 0; i < iov_len; ++i) {
+      memcpy(__capture_reserve(iov[i].iov_len), iov[i].iov_base,
+             iov[i].iov_len);
+      capture_len += iov[i].iov_len;
+    }
+
+    buf_len = 0;
+    iov_len = 0;
+    return;
+  }
+
+  struct iovec* next = iov;
+  int left = iov_len;
+
+  while (left > 0) {
+    ssize_t n = writev(STDOUT_FILENO, next, left);
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+
+      perror("ERROR: Failed to write output");
+      break;
+    }
+
+    // Skip the pieces that were written completely
+    while (left > 0 && (size_t) n >= next->iov_len) {
+      n -= next->iov_len;
+      ++next;
+      --left;
+    }
+
+    if (left > 0) {
+      next->iov_base = (char*) next->iov_base + n;
+      next->iov_len -= n;
+    }
+  }
+
+  buf_len = 0;
+  iov_len = 0;
+}
+
+// Add a piece to the queue, growing the last one if it ends where this starts.
+// The caller makes sure there is a free iovec.
+static void __queue(const char* str, size_t len) {
+  if (iov_len > 0) {
+    struct iovec* last = &iov[iov_len - 1];
+
+    if ((char*) last->iov_base + last->iov_len == str) {
+      last->iov_len += len;
+      return;
+    }
+  }
+
+  iov[iov_len++] = (struct iovec) { (char*) str, len };
+}
+
+// Flush if the next piece might not find a free iovec or len bytes of buffer
+static void __reserve(size_t len) {
+  if (iov_len == OUT_IOV_MAX || buf_len + len > OUT_BUF_SIZE)
+    out_flush();
+}
+
+void out_write(const char* str, size_t len) {
+  if (len == 0)
+    return;
+
+  if (len > OUT_COPY_MAX) {
+    __reserve(0);
+    __queue(str, len);
+    return;
+  }
+
+  __reserve(len);
+  memcpy(buf + buf_len, str, len);
+  __queue(buf + buf_len, len);
+  buf_len += len;
+}
+
+void out_str(const char* str) {
+  out_write(str, strlen(str));
+}
+
+// Format straight into the buffer when it fits, otherwise flush and retry
+void out_printf(const char* fmt, ...) {
+  va_list args;
+  int len;
+
+  __reserve(0);
+
+  va_start(args, fmt);
+  len = vsnprintf(buf + buf_len, OUT_BUF_SIZE - buf_len, fmt, args);
+  va_end(args);
+
+  if (len < 0)
+    return;
+
+  if ((size_t) len >= OUT_BUF_SIZE - buf_len) {
+    out_flush();
+
+    // Too long for the buffer even when it is empty
+    if (len >= OUT_BUF_SIZE) {
+      va_start(args, fmt);
+
+      if (capturing) {
+        vsnprintf(__capture_reserve(len + 1), len + 1, fmt, args);
+        capture_len += len;
+      }
+      else {
+        vdprintf(STDOUT_FILENO, fmt, args);
+      }
+
+      va_end(args);
+      return;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(buf, OUT_BUF_SIZE, fmt, args);
+    va_end(args);
+  }
+
+  __queue(buf + buf_len, len);
+  buf_len += len;
+}
+
+void out_capture_begin() {
+  out_flush();
+  capturing = true;
+}
+
+char* out_capture_end(size_t* len) {
+  out_flush();
+
+  char* ret = capture;
+
+  *len = capture_len;
+
+  capturing = false;
+  capture = NULL;
+  capture_len = capture_cap = 0;
+
+  return ret;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file output.h
+ *
+ * @brief Buffered standard out for builtin commands and job messages
+ *
+ * Output is gathered in a small buffer and written with a single writev() when
+ * it is flushed, instead of one write per printf() call. Short pieces are
+ * copied into the buffer and long ones are referenced where they are, so the
+ * memory behind a string passed to @a out_write() or @a out_str() has to stay
+ * valid until the next @a out_flush().
+ *
+ * Every builtin flushes before it returns. Anything else that writes to
+ * standard out, and every fork(), has to happen with this buffer empty.
+ */
+
+#ifndef SRC_OUTPUT_H
+#define SRC_OUTPUT_H
+
+#include <stddef.h>
+
+/**
+ * @brief Queue len bytes of str for standard out
+ *
+ * @param str Bytes to write
+ *
+ * @param len Number of bytes to write
+ */
+void out_write(const char* str, size_t len);
+
+/**
+ * @brief Queue a NUL terminated string for standard out
+ *
+ * @param str String to write
+ */
+void out_str(const char* str);
+
+/**
+ * @brief Queue formatted output for standard out
+ *
+ * @param fmt printf() style format string
+ */
+void out_printf(const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+/**
+ * @brief Write everything queued to standard out with one writev()
+ */
+void out_flush();
+
+/**
+ * @brief Gather output in memory instead of writing it
+ *
+ * Everything queued until @a out_capture_end(), including what @a out_flush()
+ * would have written, is kept and handed to the caller. This lets quash run a
+ * builtin for another process that only has to write the result.
+ */
+void out_capture_begin();
+
+/**
+ * @brief Stop capturing output
+ *
+ * @param[out] len Number of bytes captured
+ *
+ * @return The captured output, which the caller has to free(), or NULL if
+ * nothing was captured
+ */
+char* out_capture_end(size_t* len);
+
+#endif // SRC_OUTPUT_H
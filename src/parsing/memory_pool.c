@@ -15,26 +15,39 @@
  * bottom up (such as the parser) and can fail leaving the top most portion of
  * the structure uninitialized.
  *
- * @note A single memory pool can run out of space fast or will take up quite a
- * bit of unnecessary space in memory. To combat this problem the @a
- * MemoryPoolDeque allows the creation of a larger additional MemoryPool to
+ * @note A single block can run out of space fast or will take up quite a bit
+ * of unnecessary space in memory. To combat this problem the @a
+ * MemoryBlockDeque allows the creation of a larger additional MemoryBlock to
  * handle the allocation.
  */
-typedef struct MemoryPool {
-  void* pool;  /**< Pointer to the top of the memory pool */
-  size_t size; /**< Size of the memory pool in bytes */
+typedef struct MemoryBlock {
+  void* pool;  /**< Pointer to the top of the memory block */
+  size_t size; /**< Size of the memory block in bytes */
   void* next;  /**< The next pointer to be returned from an allocation */
-} MemoryPool;
+} MemoryBlock;
 
-IMPLEMENT_DEQUE_STRUCT(MemoryPoolDeque, MemoryPool);
-IMPLEMENT_DEQUE(MemoryPoolDeque, MemoryPool);
+IMPLEMENT_DEQUE_STRUCT(MemoryBlockDeque, MemoryBlock);
+IMPLEMENT_DEQUE(MemoryBlockDeque, MemoryBlock);
 
-static MemoryPoolDeque pool_deq = { NULL, 0, 0, 0, NULL };
+struct MemoryPool {
+  MemoryBlockDeque blocks; /**< Blocks of the pool, allocations are served from
+                            * the one at the back */
+  size_t block_mallocs;    /**< Blocks ever allocated with malloc() */
+  size_t block_frees;      /**< Blocks ever released with free() */
+};
 
-// Creates a single memory pool an returns a copy If the `size` parameter is
-// zero then this function will not allocate any space for later MemoryPool
+// Pool allocations of the calling thread are served from
+static _Thread_local MemoryPool* current_pool = NULL;
+
+// The block at the back of the current pool that allocations are served from.
+// Its record in the deque is only brought up to date by __sync_current_block().
+_Thread_local char* __memory_pool_next = NULL;
+_Thread_local char* __memory_pool_end = NULL;
+
+// Creates a single memory block an returns a copy If the `size` parameter is
+// zero then this function will not allocate any space for later MemoryBlock
 // allocations.
-static MemoryPool __initialize_memory_pool(size_t size) {
+static MemoryBlock __initialize_memory_block(MemoryPool* mp, size_t size) {
   void* mem;
 
   if (size == 0) {
@@ -43,9 +56,11 @@ static MemoryPool __initialize_memory_pool(size_t size) {
   else {
     if ((mem = malloc(size)) == NULL)
       size = 0;
+    else
+      ++mp->block_mallocs;
   }
 
-  return (MemoryPool) {
+  return (MemoryBlock) {
     mem,
     size,
     mem
@@ -53,8 +68,9 @@ static MemoryPool __initialize_memory_pool(size_t size) {
 }
 
 // Last ditch effort to allocate some memory
-static MemoryPool __low_memory_initialize_memory_pool(size_t required_size,
-                                                      size_t failed_requested_size) {
+static MemoryBlock __low_memory_initialize_memory_block(MemoryPool* mp,
+                                                        size_t required_size,
+                                                        size_t failed_requested_size) {
   while(true) {
     if (failed_requested_size <= required_size) {
       fprintf(stderr, "ERROR: Unable to allocate more memory to the memory pool.\n");
@@ -67,39 +83,117 @@ static MemoryPool __low_memory_initialize_memory_pool(size_t required_size,
       failed_requested_size = required_size;
 
     // Attempt to allocate smaller size space
-    MemoryPool ret = __initialize_memory_pool(failed_requested_size);
+    MemoryBlock ret = __initialize_memory_block(mp, failed_requested_size);
 
     if (ret.pool != NULL)
       return ret;
   }
 }
 
-static void __destroy_memory_pool(MemoryPool mp) {
-  if (mp.pool != NULL)
-    free(mp.pool);
-  mp.pool = NULL;
+// Write the bump pointer back into the deque record of the current block
+static void __sync_current_block() {
+  if (__memory_pool_next == NULL)
+    return;
+
+  MemoryBlock block = peek_back_MemoryBlockDeque(&current_pool->blocks);
+  block.next = __memory_pool_next;
+  update_back_MemoryBlockDeque(&current_pool->blocks, block);
 }
 
-void initialize_memory_pool(size_t size) {
+// Serve allocations from the block at the back of the deque
+static void __use_current_block() {
+  MemoryBlock block = peek_back_MemoryBlockDeque(&current_pool->blocks);
+
+  __memory_pool_next = block.next;
+  __memory_pool_end = (char*) block.pool + block.size;
+}
+
+static void __destroy_memory_block(MemoryPool* mp, MemoryBlock block) {
+  if (block.pool != NULL) {
+    free(block.pool);
+    ++mp->block_frees;
+  }
+}
+
+// Create a pool holding a single block of the given size
+MemoryPool* new_memory_pool(size_t size) {
+  MemoryPool* mp = malloc(sizeof(MemoryPool));
+
+  if (mp == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate a memory pool.\n");
+    exit(-1);
+  }
+
   if (size == 0)
     size = 1;
 
-  pool_deq = new_destructable_MemoryPoolDeque(10, __destroy_memory_pool);
+  mp->blocks = new_MemoryBlockDeque(10);
+  mp->block_mallocs = 0;
+  mp->block_frees = 0;
 
-  MemoryPool pool = __initialize_memory_pool(size);
+  MemoryBlock block = __initialize_memory_block(mp, size);
 
-  if (pool.pool == NULL)
+  if (block.pool == NULL)
     // We are running low on memory. Try smaller allocations or exit Quash
-    pool = __low_memory_initialize_memory_pool(1, size);
+    block = __low_memory_initialize_memory_block(mp, 1, size);
+
+  push_back_MemoryBlockDeque(&mp->blocks, block);
+
+  return mp;
+}
+
+// Switch the thread's allocations over to another pool
+void use_memory_pool(MemoryPool* pool) {
+  if (pool == current_pool)
+    return;
 
-  push_back_MemoryPoolDeque(&pool_deq, pool);
+  if (current_pool != NULL)
+    __sync_current_block();
+
+  current_pool = pool;
+
+  if (current_pool != NULL)
+    __use_current_block();
+  else
+    __memory_pool_next = __memory_pool_end = NULL;
 }
 
-void* memory_pool_alloc(size_t size) {
-  assert(!is_empty_MemoryPoolDeque(&pool_deq));
+// Pool the calling thread allocates from
+MemoryPool* current_memory_pool() {
+  return current_pool;
+}
+
+// Free every block of a pool and the pool itself
+void free_memory_pool(MemoryPool* pool) {
+  if (pool == NULL)
+    return;
+
+  if (pool == current_pool)
+    use_memory_pool(NULL);
 
-  MemoryPool pool = peek_back_MemoryPoolDeque(&pool_deq);
-  size_t init_size = peek_front_MemoryPoolDeque(&pool_deq).size;
+  while (!is_empty_MemoryBlockDeque(&pool->blocks))
+    __destroy_memory_block(pool, pop_back_MemoryBlockDeque(&pool->blocks));
+
+  destroy_MemoryBlockDeque(&pool->blocks);
+  free(pool);
+}
+
+// Create a pool and make it the current pool of the calling thread
+void initialize_memory_pool(size_t size) {
+  use_memory_pool(new_memory_pool(size));
+}
+
+// Called by memory_pool_alloc() when the current pool is full. The size is
+// already rounded up to MEMORY_POOL_ALIGNMENT.
+void* __memory_pool_alloc_slow(size_t size) {
+  assert(current_pool != NULL);
+
+  MemoryBlockDeque* blocks = &current_pool->blocks;
+
+  __sync_current_block();
+
+  MemoryBlock pool = peek_back_MemoryBlockDeque(blocks);
+  size_t init_size = peek_front_MemoryBlockDeque(blocks).size;
 
   assert(pool.pool != NULL);
   assert(pool.size != 0);
@@ -108,40 +202,127 @@ void* memory_pool_alloc(size_t size) {
   while (pool.next - pool.pool + size > pool.size) {
     // There is not enough room in the current memory pool to fit the
     // allocation. Create a new memory pool large enough to hold it. 
-    size_t length_pool_deq = length_MemoryPoolDeque(&pool_deq);
+    size_t length_pool_deq = length_MemoryBlockDeque(blocks);
     size_t new_pool_size = init_size * (2 << (length_pool_deq - 1));
 
     if (new_pool_size < size) {
       // The next pool size selected wasn't enough space. We have to have to add
       // something onto the deque since the new pool size is dependent on the
       // size of the deque.
-      pool = __initialize_memory_pool(0);
+      pool = __initialize_memory_block(current_pool, 0);
     }
     else {
-      // Create a MemoryPool with the correct amount of space
-      pool = __initialize_memory_pool(new_pool_size);
+      // Create a MemoryBlock with the correct amount of space
+      pool = __initialize_memory_block(current_pool, new_pool_size);
 
       if (pool.pool == NULL)
         // We are running low on memory. Try smaller allocations or exit Quash
-        pool = __low_memory_initialize_memory_pool(size, new_pool_size);
+        pool = __low_memory_initialize_memory_block(current_pool, size,
+                                                    new_pool_size);
     }
 
-    push_back_MemoryPoolDeque(&pool_deq, pool);
+    push_back_MemoryBlockDeque(blocks, pool);
   }
 
-  assert(pool.next == peek_back_MemoryPoolDeque(&pool_deq).next);
-  void* ret = pool.next;
-  pool.next += size;
+  // Blocks come from malloc() so their start is suitably aligned for anything
+  __use_current_block();
 
-  // Update record
-  update_back_MemoryPoolDeque(&pool_deq, pool);
+  void* ret = __memory_pool_next;
+  __memory_pool_next += size;
 
   return ret;
 }
 
-// Free all memory contained in the MemoryPoolDeque
+// Free all memory contained in the current pool
 void destroy_memory_pool() {
-  destroy_MemoryPoolDeque(&pool_deq);
+  free_memory_pool(current_pool);
+}
+
+// Keep the largest pool, or one big enough for everything used since the last
+// reset, and rewind it
+void reset_memory_pool() {
+  assert(current_pool != NULL);
+
+  MemoryBlockDeque* blocks = &current_pool->blocks;
+
+  // A command that fit in a single block leaves nothing to do but rewind it
+  if (length_MemoryBlockDeque(blocks) == 1) {
+    __memory_pool_next = peek_front_MemoryBlockDeque(blocks).pool;
+    return;
+  }
+
+  __sync_current_block();
+
+  MemoryBlock largest = { NULL, 0, NULL };
+  size_t used = 0;
+
+  while (!is_empty_MemoryBlockDeque(blocks)) {
+    MemoryBlock pool = pop_back_MemoryBlockDeque(blocks);
+
+    used += pool.next - pool.pool;
+
+    if (pool.size > largest.size) {
+      __destroy_memory_block(current_pool, largest);
+      largest = pool;
+    }
+    else {
+      __destroy_memory_block(current_pool, pool);
+    }
+  }
+
+  if (largest.size < used) {
+    // The last command needed several blocks. Grow to a single block that
+    // holds all of it so the next command like it needs no further allocations.
+    size_t size = largest.size;
+
+    while (size < used)
+      size <<= 1;
+
+    MemoryBlock pool = __initialize_memory_block(current_pool, size);
+
+    if (pool.pool == NULL) {
+      // Not enough memory to grow. Keep using what we already have.
+      pool = largest;
+    }
+    else {
+      __destroy_memory_block(current_pool, largest);
+    }
+
+    largest = pool;
+  }
+
+  largest.next = largest.pool;
+  push_back_MemoryBlockDeque(blocks, largest);
+  __use_current_block();
+}
+
+// Report how the memory pool is being used
+MemoryPoolStats memory_pool_stats() {
+  MemoryPoolStats stats = { 0, 0, 0, 0, 0 };
+
+  if (current_pool == NULL)
+    return stats;
+
+  stats.block_mallocs = current_pool->block_mallocs;
+  stats.block_frees = current_pool->block_frees;
+
+  __sync_current_block();
+
+  MemoryBlockDequeSpan spans[2];
+
+  spans_MemoryBlockDeque(&current_pool->blocks, spans);
+
+  for (int s = 0; s < 2; ++s) {
+    for (size_t i = 0; i < spans[s].len; ++i) {
+      MemoryBlock* pool = &spans[s].data[i];
+
+      stats.bytes_allocated += pool->next - pool->pool;
+      stats.bytes_reserved += pool->size;
+      ++stats.blocks;
+    }
+  }
+
+  return stats;
 }
 
 // Simple replacement for strdup() that uses the memory pool rather than malloc
@@ -151,7 +332,7 @@ char* memory_pool_strdup(const char* str) {
   size_t len = strlen(str) + 1;
   char* ret = memory_pool_alloc(len);
 
-  strcpy(ret, str);
+  memcpy(ret, str, len);
 
   return ret;
 }
@@ -14,18 +14,104 @@
  * comfortable with malloc based memory management. YOU WILL BE PENALIZED FOR
  * USING ANYTHING IN THIS FILE TO HIDE MEMORY LEAKS.
  *
- * @warning The memory pool allocations are not thread safe
+ * @warning Every thread allocates from a memory pool of its own, its current
+ * pool. A thread must call initialize_memory_pool(), or use_memory_pool() with
+ * a pool made by new_memory_pool(), before allocating. A pool must be current
+ * on only one thread at a time, and memory allocated from it must not be used
+ * after the pool is reset or freed.
  */
 
 #ifndef SRC_PARSING_MEMORY_POOL_H
 #define SRC_PARSING_MEMORY_POOL_H
 
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "deque.h"
 
 /**
- * @brief Allocate the memory pool
+ * @def MEMORY_POOL_ALIGNMENT
+ *
+ * @brief Alignment of every pointer returned by @a memory_pool_alloc()
+ *
+ * Requests are rounded up to a multiple of this size, so an array of pointers
+ * or structures allocated right after a string is still correctly aligned.
+ */
+#define MEMORY_POOL_ALIGNMENT (_Alignof(max_align_t))
+
+/** @cond Doxygen_Suppress */
+// Bump pointer and end of the block allocations are currently served from.
+// These are only exposed for the inline fast path of memory_pool_alloc().
+extern _Thread_local char* __memory_pool_next;
+extern _Thread_local char* __memory_pool_end;
+
+void* __memory_pool_alloc_slow(size_t size);
+/** @endcond Doxygen_Suppress */
+
+/**
+ * @brief A pool of memory blocks that allocations are served from
+ *
+ * Only the blocks of a pool are freed, never single allocations. The structure
+ * is opaque, a pool is only used through the functions below.
+ *
+ * @sa new_memory_pool(), use_memory_pool()
+ */
+typedef struct MemoryPool MemoryPool;
+
+/**
+ * @brief Usage statistics of the memory pool
+ *
+ * @sa memory_pool_stats()
+ */
+typedef struct MemoryPoolStats {
+  size_t bytes_allocated; /**< Bytes handed out since the last reset */
+  size_t bytes_reserved;  /**< Bytes held by all blocks of the pool */
+  size_t blocks;          /**< Number of blocks currently in the pool */
+  size_t block_mallocs;   /**< Number of blocks ever allocated with malloc() */
+  size_t block_frees;     /**< Number of blocks ever released with free() */
+} MemoryPoolStats;
+
+/**
+ * @brief Allocate a memory pool without making it current
+ *
+ * @param size The initial size of the memory pool. If this value is zero then a
+ * default size of one is used.
+ *
+ * @return The new pool, to be released with free_memory_pool()
+ */
+MemoryPool* new_memory_pool(size_t size);
+
+/**
+ * @brief Make a pool the current pool of the calling thread
+ *
+ * Every function below that takes no pool, memory_pool_alloc() included,
+ * works on the current pool. Switching to the pool that is already current
+ * does nothing.
+ *
+ * @param pool The pool to allocate from or NULL to have no current pool
+ */
+void use_memory_pool(MemoryPool* pool);
+
+/**
+ * @brief Get the current pool of the calling thread
+ *
+ * @return The current pool or NULL if there is none
+ */
+MemoryPool* current_memory_pool();
+
+/**
+ * @brief Free a pool made by new_memory_pool() and everything allocated in it
+ *
+ * If the pool is current, the calling thread is left without a current pool.
+ *
+ * @param pool The pool to free. Nothing is done if this is NULL.
+ */
+void free_memory_pool(MemoryPool* pool);
+
+/**
+ * @brief Allocate a memory pool and make it the current pool of the calling
+ * thread
  *
  * @param size The initial size of the memory pool. If this value is zero then a
  * default size of one is used.
@@ -38,17 +124,53 @@ void initialize_memory_pool(size_t size);
  * malloc() without the requirement of calling free() directly on the returned
  * pointer.
  *
+ * The common case of the request fitting in the current block is a pointer
+ * bump inlined into the caller. Only a full block calls into memory_pool.c.
+ *
  * @param size Size in bytes of the requested reserved space
  *
- * @return A pointer to a unique array of size bytes
+ * @return A pointer to a unique array of size bytes aligned to @a
+ * MEMORY_POOL_ALIGNMENT
  */
-void* memory_pool_alloc(size_t size);
+static inline void* memory_pool_alloc(size_t size) {
+  size = (size + MEMORY_POOL_ALIGNMENT - 1) & ~(MEMORY_POOL_ALIGNMENT - 1);
+
+  if (size <= (size_t) (__memory_pool_end - __memory_pool_next)) {
+    void* ret = __memory_pool_next;
+    __memory_pool_next += size;
+    return ret;
+  }
+
+  return __memory_pool_alloc_slow(size);
+}
 
 /**
- * @brief Free all memory allocated in the memory pool
+ * @brief Free all memory allocated in the current pool and the pool itself
  */
 void destroy_memory_pool();
 
+/**
+ * @brief Invalidate every allocation in the memory pool but keep the pool
+ * itself for the next command
+ *
+ * This has the same effect for callers as destroy_memory_pool() followed by
+ * initialize_memory_pool(). The largest block is rewound and kept. If the
+ * allocations since the last reset did not fit in it, a single block large
+ * enough for all of them replaces it instead. Once the pool has grown to the
+ * size a command needs, resetting and reusing it calls neither malloc() nor
+ * free().
+ */
+void reset_memory_pool();
+
+/**
+ * @brief Get the usage statistics of the memory pool
+ *
+ * @return A copy of the current statistics
+ *
+ * @sa MemoryPoolStats
+ */
+MemoryPoolStats memory_pool_stats();
+
 /**
  * @brief A version of strdup() that allocates the duplicate to the memory pool
  * rather than with malloc directly
@@ -59,6 +181,22 @@ void destroy_memory_pool();
  */
 char* memory_pool_strdup(const char* str);
 
+/** @cond Doxygen_Suppress */
+// Allocation hooks of the deques generated by IMPLEMENT_DEQUE_MEMORY_POOL().
+// Pool memory cannot be resized or given back on its own, so growing copies
+// into a new allocation and releasing does nothing.
+static inline void* __deque_pool_resize(void* data, size_t old_size,
+                                        size_t size) {
+  void* ret = memory_pool_alloc(size);
+  memcpy(ret, data, old_size);
+  return ret;
+}
+
+static inline void __deque_pool_release(void* data) {
+  (void) data;
+}
+/** @endcond Doxygen_Suppress */
+
 /**
  * @brief Generates a @a memory_pool_alloc() based set of functions for use with
  * a structure generated by @a IMPLEMENT_DEQUE_STRUCT
@@ -68,251 +206,10 @@ char* memory_pool_strdup(const char* str);
  * @param type The name of the type of elements stored in the @a struct_name
  * structure
  *
- * @sa IMPLEMENT_DEQUE_STRUCT, PROTOTYPE_DEQUE, IMPLEMENT_DEQUE_MEMORY_POOL,
- * memory_pool_alloc()
+ * @sa IMPLEMENT_DEQUE_STRUCT, IMPLEMENT_DEQUE_ALLOCATOR, memory_pool_alloc()
  */
 #define IMPLEMENT_DEQUE_MEMORY_POOL(struct_name, type)                  \
-                                                                        \
-  void apply_##struct_name(struct_name*, void (*)(type));               \
-                                                                        \
-  struct_name new_##struct_name(size_t init_cap) {                      \
-    struct_name ret;                                                    \
-                                                                        \
-    if (init_cap > 0)                                                   \
-      ret.cap = init_cap;                                               \
-    else                                                                \
-      ret.cap = 1;                                                      \
-                                                                        \
-    ret.data = (type*) memory_pool_alloc(ret.cap * sizeof(type));       \
-                                                                        \
-    if (ret.data == NULL) {                                             \
-      fprintf(stderr, "ERROR: Failed to reallocate struct_name"         \
-              " contents");                                             \
-      abort();                                                          \
-    }                                                                   \
-                                                                        \
-    ret.front = ret.back = 0;                                           \
-    ret.destructor = NULL;                                              \
-                                                                        \
-    return ret;                                                         \
-  }                                                                     \
-                                                                        \
-  struct_name new_destructable_##struct_name(size_t init_cap,           \
-                                             void (*destructor)(type)){ \
-    struct_name ret = new_##struct_name(init_cap);                      \
-    ret.destructor = destructor;                                        \
-    return ret;                                                         \
-  }                                                                     \
-                                                                        \
-  void destroy_##struct_name(struct_name* deq) {                        \
-    assert(deq != NULL);                                                \
-                                                                        \
-    if (deq->data == NULL)                                              \
-      return;                                                           \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      apply_##struct_name(deq, deq->destructor);                        \
-                                                                        \
-    deq->data = NULL;                                                   \
-    deq->cap = 0;                                                       \
-    deq->front = deq->back = 0;                                         \
-  }                                                                     \
-                                                                        \
-  void empty_##struct_name(struct_name* deq) {                          \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      apply_##struct_name(deq, deq->destructor);                        \
-                                                                        \
-    deq->front = deq->back = 0;                                         \
-  }                                                                     \
-                                                                        \
-  bool is_empty_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return deq->front == deq->back;                                     \
-  }                                                                     \
-                                                                        \
-  size_t length_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return (deq->back - deq->front + deq->cap) % deq->cap;              \
-  }                                                                     \
-                                                                        \
-  static void __reallign_##struct_name(struct_name* deq) {              \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    if (deq->front != 0) {                                              \
-      type* old_data = deq->data;                                       \
-      size_t len = length_##struct_name(deq);                           \
-                                                                        \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
-                                                                        \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents");                                           \
-        abort();                                                        \
-      }                                                                 \
-                                                                        \
-      size_t i;                                                         \
-                                                                        \
-      for (i = 0; i < len; ++i)                                         \
-        deq->data[i] = old_data[(deq->front + i) % deq->cap];           \
-                                                                        \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  type* as_array_##struct_name(struct_name* deq, size_t* len) {         \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    __reallign_##struct_name(deq);                                      \
-                                                                        \
-    type* ret = deq->data;                                              \
-                                                                        \
-    if (len != NULL)                                                    \
-      *len = length_##struct_name(deq);                                 \
-                                                                        \
-    deq->data = NULL;                                                   \
-    deq->cap = deq->front = deq->back = 0;                              \
-                                                                        \
-    return ret;                                                         \
-  }                                                                     \
-                                                                        \
-  void apply_##struct_name(struct_name* deq, void (*func)(type)) {      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-                                                                        \
-    size_t len = length_##struct_name(deq);                             \
-                                                                        \
-    for (size_t i = 0; i < len; ++i) {                                  \
-      func(deq->data[(deq->front + i) % deq->cap]);                     \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  static void __on_push_##struct_name(struct_name* deq) {               \
-    if (deq->front == (deq->back + 1) % deq->cap) {                     \
-      type* old_data = deq->data;                                       \
-      size_t old_cap = deq->cap;                                        \
-                                                                        \
-      deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
-                                                                        \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents\n");                                         \
-        abort();                                                        \
-      }                                                                 \
-                                                                        \
-      size_t i;                                                         \
-                                                                        \
-      for (i = 0; i < old_cap - 1; ++i)                                 \
-        deq->data[i] = old_data[(deq->front + i) % old_cap];            \
-                                                                        \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  static void __on_pop_##struct_name(struct_name* deq) {                \
-    if (is_empty_##struct_name(deq)) {                                  \
-      fprintf(stderr, "ERROR: Cannot pop from of struct_name while it " \
-              "is empty\n");                                            \
-      abort();                                                          \
-    }                                                                   \
-  }                                                                     \
-                                                                        \
-  void push_front_##struct_name(struct_name* deq, type element) {       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->front = (deq->front + deq->cap - 1) % deq->cap;                \
-    deq->data[deq->front] = element;                                    \
-  }                                                                     \
-                                                                        \
-  void push_back_##struct_name(struct_name* deq, type element) {        \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_push_##struct_name(deq);                                       \
-    deq->data[deq->back] = element;                                     \
-    deq->back = (deq->back + 1) % deq->cap;                             \
-  }                                                                     \
-                                                                        \
-  type pop_front_##struct_name(struct_name* deq) {                      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_pop_##struct_name(deq);                                        \
-    size_t old_front = deq->front;                                      \
-    deq->front = (deq->front + 1) % deq->cap;                           \
-    return deq->data[old_front];                                        \
-  }                                                                     \
-                                                                        \
-  type pop_back_##struct_name(struct_name* deq) {                       \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    __on_pop_##struct_name(deq);                                        \
-    deq->back = (deq->back + deq->cap - 1) % deq->cap;                  \
-    return deq->data[deq->back];                                        \
-  }                                                                     \
-                                                                        \
-  type peek_front_##struct_name(struct_name* deq) {                     \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[deq->front];                                       \
-  }                                                                     \
-                                                                        \
-  type peek_back_##struct_name(struct_name* deq) {                      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[(deq->back + deq->cap - 1) % deq->cap];            \
-  }                                                                     \
-                                                                        \
-  void update_front_##struct_name(struct_name* deq, type element) {     \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    deq->data[deq->front] = element;                                    \
-  }                                                                     \
-                                                                        \
-  void update_back_##struct_name(struct_name* deq, type element) {      \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-    deq->data[(deq->back + deq->cap - 1) % deq->cap] = element;         \
-  }                                                                     \
-                                                                        \
-  void update_and_destroy_front_##struct_name(struct_name* deq,         \
-                                              type element) {           \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-                                                                        \
-    size_t idx = deq->front;                                            \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      deq->destructor(deq->data[idx]);                                  \
-                                                                        \
-    deq->data[idx] = element;                                           \
-  }                                                                     \
-                                                                        \
-  void update_and_destroy_back_##struct_name(struct_name* deq,          \
-                                             type element) {            \
-    assert(deq != NULL);                                                \
-    assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    assert(!is_empty_##struct_name(deq));                               \
-                                                                        \
-    size_t idx = (deq->back + deq->cap - 1) % deq->cap;                 \
-                                                                        \
-    if (deq->destructor != NULL)                                        \
-      deq->destructor(deq->data[idx]);                                  \
-                                                                        \
-    deq->data[idx] = element;                                           \
-  }
+  IMPLEMENT_DEQUE_ALLOCATOR(struct_name, type, memory_pool_alloc,       \
+                            __deque_pool_resize, __deque_pool_release)
 
 #endif
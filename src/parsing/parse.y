@@ -7,16 +7,6 @@
 #include "parsing_interface.h"
 #include "parse.tab.h"
 #include "memory_pool.h"
-
-extern int yylineno;
-extern char* yytext;
-extern FILE* yyin;
-
-extern void yyerror(CommandHolder**, char*);
-extern int yyparse(CommandHolder**);
-extern int yylex();
-
-int yyerrstatus = 0;
 %}
 
 %code requires {
@@ -39,21 +29,34 @@ int yyerrstatus = 0;
   Redirect redirect;
 }
 
-%parse-param { CommandHolder** __ret_cmds }
+/* Everything a call to the parser needs or produces is held in its context
+ * and the reentrant scanner it reads tokens from */
+%define api.pure full
+%param { yyscan_t scanner } { ParseContext* ctx }
+
+%code {
+extern int yylex(YYSTYPE* yylval, yyscan_t scanner, ParseContext* ctx);
+extern int yyget_lineno(yyscan_t scanner);
+extern void yyerror(yyscan_t scanner, ParseContext* ctx, const char* str);
+}
+
+/* Whatever the parser allocates comes from the pool of its context */
+%initial-action { use_memory_pool(ctx->pool); }
 
 /* Terminals */
 %token PIPE BCKGRND SQUOTE EQUALS REDIRIN REDIROUT REDIROUTAPP END
-%token ECHO_TOK EXPORT_TOK CD_TOK PWD_TOK JOBS_TOK KILL_TOK EOC_TOK
+%token SEMI_TOK AND_TOK OR_TOK
+%token ECHO_TOK EXPORT_TOK CD_TOK PWD_TOK JOBS_TOK KILL_TOK HASH_TOK EOC_TOK
 %token <str> STR SIM_STR ID NUM EXIT_TOK
 
 /* Non-terminals */
 %type <str> string first_string special_string
-%type <integer> cmd_bg redir_mark
+%type <integer> redir_mark
 %type <redirect> redir redir_inner
 %type <holder> cmd_top
 %type <cmd> cmd_content
 %type <cmd_strs> cmd cmd_arguments
-%type <cmd_list> cmds
+%type <cmd_list> list list_head pipeline
 %type <cmd_arr> top
 
 /* Start symbol */
@@ -62,70 +65,102 @@ int yyerrstatus = 0;
 %%
 
 top:    EOC_TOK {
-  *__ret_cmds = NULL;
+  ctx->script = NULL;
 
   YYACCEPT;
 }
-|       cmds EOC_TOK {
-  push_back_Cmds(&$1, mk_command_holder(NULL, NULL, 0, mk_eoc()));
-
-  *__ret_cmds = as_array_Cmds(&$1, NULL);
+|       list EOC_TOK {
+  ctx->script = as_array_Cmds(&$1, NULL);
 
   YYACCEPT;
 }
-|       cmds END {
-  push_back_Cmds(&$1, mk_command_holder(NULL, NULL, 0, mk_eoc()));
+|       END {
+  ctx->script = NULL;
+  ctx->at_end = true;
 
-  *__ret_cmds = as_array_Cmds(&$1, NULL);
-
-  end_main_loop(EXIT_SUCCESS);
+  YYACCEPT;
+}
+|       list END {
+  ctx->script = as_array_Cmds(&$1, NULL);
+  ctx->at_end = true;
 
   YYACCEPT;
 }
 |       error EOC_TOK {
-  *__ret_cmds = NULL;
+  ctx->script = NULL;
 
   YYABORT;
 }
 |       error END {
-  *__ret_cmds = NULL;
-
-  end_main_loop(EXIT_FAILURE);
+  ctx->script = NULL;
+  ctx->at_end = true;
 
   YYABORT;
 }
 
 
 
-cmds:   cmd_top {
+/* Every rule building a list is left recursive and appends to the back of a
+ * deque, so the parser stack stays shallow however long a line is */
+list:   list_head pipeline {
+  $$ = append_pipeline($1, &$2, LIST_END);
+}
+|       list_head pipeline SEMI_TOK {
+  $$ = append_pipeline($1, &$2, LIST_END);
+}
+|       list_head pipeline BCKGRND {
+  set_background(&$2);
+
+  $$ = append_pipeline($1, &$2, LIST_END);
+}
+
+
+
+list_head: %empty {
+  $$ = new_Cmds(1);
+}
+|       list_head pipeline SEMI_TOK {
+  $$ = append_pipeline($1, &$2, LIST_SEQ);
+}
+|       list_head pipeline BCKGRND {
+  set_background(&$2);
+
+  $$ = append_pipeline($1, &$2, LIST_SEQ);
+}
+|       list_head pipeline AND_TOK {
+  $$ = append_pipeline($1, &$2, LIST_AND);
+}
+|       list_head pipeline OR_TOK {
+  $$ = append_pipeline($1, &$2, LIST_OR);
+}
+
+
+
+pipeline: cmd_top {
   Cmds cs = new_Cmds(1);
 
-  push_front_Cmds(&cs, $1);
+  push_back_Cmds(&cs, $1);
 
   $$ = cs;
 }
-|       cmd_top PIPE cmds {
-  CommandHolder prev = pop_front_Cmds(&$3);
-
-  $1.flags = ($1.flags & ~(REDIRECT_APPEND | REDIRECT_OUT)) | PIPE_OUT;
-  prev.flags = (prev.flags & ~REDIRECT_IN) | PIPE_IN;
+|       pipeline PIPE cmd_top {
+  CommandHolder prev = peek_back_Cmds(&$1);
 
-  if (prev.flags & BACKGROUND)
-    $1.flags |= BACKGROUND;
+  prev.flags = (prev.flags & ~(REDIRECT_APPEND | REDIRECT_OUT)) | PIPE_OUT;
+  $3.flags = ($3.flags & ~REDIRECT_IN) | PIPE_IN;
 
-  push_front_Cmds(&$3, prev);
-  push_front_Cmds(&$3, $1);
+  update_back_Cmds(&$1, prev);
+  push_back_Cmds(&$1, $3);
 
-  $$ = $3;
+  $$ = $1;
 }
 
 
 
-cmd_top: cmd_content redir cmd_bg {
+cmd_top: cmd_content redir {
   char flags = (($2.append)? REDIRECT_APPEND : 0) |
     (($2.out)? REDIRECT_OUT : 0) |
-    (($2.in)? REDIRECT_IN : 0) |
-    ($3? BACKGROUND : 0);
+    (($2.in)? REDIRECT_IN : 0);
 
   $$ = mk_command_holder($2.in, $2.out, flags, $1);
 }
@@ -133,6 +168,8 @@ cmd_top: cmd_content redir cmd_bg {
 
 
 cmd_content: cmd {
+  push_back_CmdStrs(&$1, NULL);
+
   $$ = mk_generic_command(as_array_CmdStrs(&$1, NULL));
 }
 |       ECHO_TOK {
@@ -141,24 +178,19 @@ cmd_content: cmd {
   $$ = mk_echo_command(cmd);
 }
 |       ECHO_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
   $$ = mk_echo_command(as_array_CmdStrs(&$2, NULL));
 }
 |       EXPORT_TOK ID EQUALS string {
   $$ = mk_export_command($2, $4);
 }
 |       CD_TOK {
-  $$ = mk_cd_command(memory_pool_strdup(lookup_env("HOME")));
+  // Resolved against HOME and the working directory when the command runs
+  $$ = mk_cd_command(NULL);
 }
 |       CD_TOK string {
-  char* resolved_path;
-  char* ret = NULL;
-
-  if ((resolved_path = realpath($2, NULL)) != NULL) {
-    ret = memory_pool_strdup(resolved_path);
-    free(resolved_path);
-  }
-
-  $$ = mk_cd_command(ret);
+  $$ = mk_cd_command($2);
 }
 |       PWD_TOK {
   $$ = mk_pwd_command();
@@ -172,6 +204,19 @@ cmd_content: cmd {
 |       KILL_TOK NUM NUM {
   $$ = mk_kill_command($2, $3);
 }
+|       HASH_TOK {
+  char** args = memory_pool_alloc(2 * sizeof(char*));
+  args[0] = "hash";
+  args[1] = NULL;
+  $$ = mk_hash_command(args);
+}
+|       HASH_TOK cmd_arguments {
+  // The arguments follow the name like those of a program
+  push_front_CmdStrs(&$2, "hash");
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_hash_command(as_array_CmdStrs(&$2, NULL));
+}
 
 redir: redir_inner {
   $$ = $1;
@@ -226,43 +271,33 @@ redir_mark: REDIRIN {
 
 
 
-cmd_bg: {
-  $$ = 0;
-}
-|       BCKGRND {
-  $$ = 1;
-}
-
-
+/* The NULL ending an argument list is appended by cmd_content */
+cmd:    first_string {
+  CmdStrs args = new_CmdStrs(8);
 
-cmd:    first_string cmd_arguments {
-  push_front_CmdStrs(&$2, $1);
+  push_back_CmdStrs(&args, $1);
 
-  $$ = $2;
+  $$ = args;
 }
-|       first_string {
-  CmdStrs args = new_CmdStrs(1);
+|       cmd string {
+  push_back_CmdStrs(&$1, $2);
 
-  push_front_CmdStrs(&args, $1);
-  push_back_CmdStrs(&args, NULL);
-
-  $$ = args;
+  $$ = $1;
 }
 
 
 
 cmd_arguments: string {
-  CmdStrs args = new_CmdStrs(1);
+  CmdStrs args = new_CmdStrs(8);
 
-  push_front_CmdStrs(&args, $1);
-  push_back_CmdStrs(&args, NULL);
+  push_back_CmdStrs(&args, $1);
 
   $$ = args;
 }
-|       string cmd_arguments {
-  push_front_CmdStrs(&$2, $1);
+|       cmd_arguments string {
+  push_back_CmdStrs(&$1, $2);
 
-  $$ = $2;
+  $$ = $1;
 }
 
 
@@ -274,30 +309,35 @@ string: first_string {
   $$ = $1;
 }
 
+/* Keywords used as arguments are never written to, so they are static */
 special_string: ECHO_TOK {
-  $$ = memory_pool_strdup("echo");
+  $$ = "echo";
 }
 |       EXPORT_TOK {
-  $$ = memory_pool_strdup("export");
+  $$ = "export";
 }
 |       CD_TOK {
-  $$ = memory_pool_strdup("cd");
+  $$ = "cd";
 }
 |       KILL_TOK {
-  $$ = memory_pool_strdup("kill");
+  $$ = "kill";
 }
 |       PWD_TOK {
-  $$ = memory_pool_strdup("pwd");
+  $$ = "pwd";
 }
 |       JOBS_TOK {
-  $$ = memory_pool_strdup("jobs");
+  $$ = "jobs";
+}
+|       HASH_TOK {
+  $$ = "hash";
 }
 |       EXIT_TOK {
   $$ = $1;
 }
 
+/* The lexer has already interpreted complex strings */
 first_string: STR {
-  $$ = interpret_complex_string_token($1);
+  $$ = $1;
 }
 |       SIM_STR {
   $$ = $1;
@@ -311,6 +351,6 @@ first_string: STR {
 
 %%
 
-void yyerror(CommandHolder** cmds, char *str) {
-  fprintf(stderr, "%s: Line %d\n", str, yylineno);
+void yyerror(yyscan_t scanner, ParseContext* ctx, const char* str) {
+  report_parse_error(ctx, "%s: Line %d\n", str, yyget_lineno(scanner));
 }
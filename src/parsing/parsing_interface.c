@@ -1,97 +1,112 @@
+#define _GNU_SOURCE
+
 #include "parsing_interface.h"
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "memory_pool.h"
 #include "parse.tab.h"
+#include "script_cache.h"
+
+extern yyscan_t create_lex();
+extern void destroy_lex(yyscan_t scanner);
+extern bool lex_scan_buffer(yyscan_t scanner, char* base, size_t size);
+
+// Scanner of the main loop, created when it first reads input
+static yyscan_t scanner = NULL;
+
+// Script mapped by parse_from_file()
+static char* script_map = NULL;
+static size_t script_map_len = 0;
+static size_t script_len = 0;
+
+// Set once the script has been compiled. The first parse() compiles it.
+static bool script_opened = false;
+static bool script_compiled = false;
+
+// Destination of the command serializer. With a NULL buffer nothing is written
+// and only the length is counted.
+typedef struct CmdStrWriter {
+  char* buf;
+  size_t pos;
+} CmdStrWriter;
+
+// Append a word followed by a space
+static inline void __emit(CmdStrWriter* w, const char* str) {
+  size_t len = strlen(str);
+
+  if (w->buf != NULL) {
+    memcpy(w->buf + w->pos, str, len);
+    w->buf[w->pos + len] = ' ';
+  }
 
-IMPLEMENT_DEQUE_STRUCT(SizeStack, size_t);
-IMPLEMENT_DEQUE_STRUCT(StrBuilder, char);
-IMPLEMENT_DEQUE_STRUCT(MPStrBuilder, char);
-
-IMPLEMENT_DEQUE(SizeStack, size_t);
-IMPLEMENT_DEQUE(StrBuilder, char);
-IMPLEMENT_DEQUE_MEMORY_POOL(MPStrBuilder, char);
-IMPLEMENT_DEQUE_MEMORY_POOL(CmdStrs, char*);
-IMPLEMENT_DEQUE_MEMORY_POOL(Cmds, CommandHolder);
-
-extern void destroy_lex();
-
-// Generate a string based off of a pipable generic command
-static inline void __stringify_generic_cmd(GenericCommand cmd, CmdStrs* strs) {
-  // Extract argument strings
-  for (size_t i = 0; cmd.args[i] != NULL; ++i)
-    push_back_CmdStrs(strs, cmd.args[i]);
-}
-
-static inline void __stringify_echo_cmd(EchoCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("echo"));
-
-  // Extract argument strings
-  for (size_t i = 0; cmd.args[i] != NULL; ++i)
-    push_back_CmdStrs(strs, cmd.args[i]);
-}
-
-// Generate a string based off the export command
-static void __stringify_export_cmd(ExportCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("export"));
-  push_back_CmdStrs(strs, cmd.env_var);
-  push_back_CmdStrs(strs, cmd.val);
-}
-
-// Generate a string based off of the cd command
-static void __stringify_cd_cmd(CDCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("cd"));
-  push_back_CmdStrs(strs, cmd.dir);
-}
-
-// Generate a string based off of the kill command
-static void __stringify_kill_cmd(KillCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("kill"));
-  push_back_CmdStrs(strs, cmd.sig_str);
-  push_back_CmdStrs(strs, cmd.job_str);
+  w->pos += len + 1;
 }
 
-// Generate a string based off the a variant of a simple command
-static void __stringify_simple_cmd(const char* str, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup(str));
+// Append every string of a NULL terminated argument array
+static inline void __emit_args(CmdStrWriter* w, char** args) {
+  for (size_t i = 0; args[i] != NULL; ++i)
+    __emit(w, args[i]);
 }
 
 // Entry point for turning a command into a string
-static void __stringify_command(Command cmd, CmdStrs* strs) {
+static void __serialize_command(Command cmd, CmdStrWriter* w) {
   switch (get_command_type(cmd)) {
   case GENERIC:
-    __stringify_generic_cmd(cmd.generic, strs);
+    __emit_args(w, cmd.generic.args);
     break;
 
   case ECHO:
-    __stringify_echo_cmd(cmd.echo, strs);
+    __emit(w, "echo");
+    __emit_args(w, cmd.echo.args);
     break;
 
   case EXPORT:
-    __stringify_export_cmd(cmd.export, strs);
+    __emit(w, "export");
+    __emit(w, cmd.export.env_var);
+    __emit(w, cmd.export.val);
     break;
 
   case CD:
-    __stringify_cd_cmd(cmd.cd, strs);
+    __emit(w, "cd");
+
+    if (cmd.cd.dir != NULL)
+      __emit(w, cmd.cd.dir);
     break;
 
   case KILL:
-    __stringify_kill_cmd(cmd.kill, strs);
+    __emit(w, "kill");
+    __emit(w, cmd.kill.sig_str);
+    __emit(w, cmd.kill.job_str);
     break;
 
   case PWD:
-    __stringify_simple_cmd("PWD", strs);
+    __emit(w, "PWD");
     break;
 
   case JOBS:
-    __stringify_simple_cmd("JOBS", strs);
+    __emit(w, "JOBS");
     break;
 
   case EXIT:
-    __stringify_simple_cmd("EXIT", strs);
+    __emit(w, "EXIT");
+    break;
+
+  case HASH:
+    __emit_args(w, cmd.hash.args);
     break;
 
   default:
@@ -99,70 +114,96 @@ static void __stringify_command(Command cmd, CmdStrs* strs) {
   }
 }
 
-static void __stringify_holder(CommandHolder holder, CmdStrs* strs) {
-  __stringify_command(holder.cmd, strs);
+static void __serialize_holder(CommandHolder holder, CmdStrWriter* w) {
+  __serialize_command(holder.cmd, w);
 
   // Generate redirect symbols and extract file names
   if (holder.flags & REDIRECT_IN) {
-    push_back_CmdStrs(strs, memory_pool_strdup("<"));
-    push_back_CmdStrs(strs, holder.redirect_in);
+    __emit(w, "<");
+    __emit(w, holder.redirect_in);
   }
 
   if (holder.flags & REDIRECT_APPEND)
-    push_back_CmdStrs(strs, memory_pool_strdup(">>"));
+    __emit(w, ">>");
   else if (holder.flags & REDIRECT_OUT)
-    push_back_CmdStrs(strs, memory_pool_strdup(">"));
+    __emit(w, ">");
 
   if (holder.flags & REDIRECT_OUT)
-    push_back_CmdStrs(strs, holder.redirect_out);
+    __emit(w, holder.redirect_out);
 
   // Generate the pipe symbol
   if (holder.flags & PIPE_OUT)
-    push_back_CmdStrs(strs, memory_pool_strdup("|"));
+    __emit(w, "|");
+}
+
+static void __serialize_pipeline(const CommandHolder* holders,
+                                 CmdStrWriter* w) {
+  for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
+    __serialize_holder(holders[i], w);
+
+  if (holders[0].flags & BACKGROUND)
+    __emit(w, "&");
 }
 
-// Create an array of strings representing the command returned from the parser
-static void __stringify_script(const CommandHolder* holders, CmdStrs* strs) {
+// Build the string representing a pipeline. Each word is followed by a space.
+// The length is measured first so the words are copied straight into a single
+// allocation.
+char* stringify_pipeline(const CommandHolder* holders) {
   assert(holders != NULL);
-  assert(strs != NULL);
 
-  if (holders != NULL) {
-    for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
-      __stringify_holder(holders[i], strs);
+  CmdStrWriter w = { NULL, 0 };
+  __serialize_pipeline(holders, &w);
 
-    if (holders[0].flags & BACKGROUND)
-      push_back_CmdStrs(strs, memory_pool_strdup("&"));
+  w.buf = (char*) malloc(w.pos + 1);
+
+  if (w.buf == NULL) {
+    perror("ERROR: Failed to allocate command string");
+    abort();
   }
 
-  push_back_CmdStrs(strs, NULL);
+  w.buf[w.pos] = '\0';
+  w.pos = 0;
+  __serialize_pipeline(holders, &w);
+
+  return w.buf;
 }
 
-// Concatenates arrays of strings together to form a single string with each
-// string separated by a space.
-static char* __condense_string_array(char** str_arr) {
-  SizeStack ss = new_SizeStack(10);
-  size_t len = 0;
+// Append only string builder living in the memory pool. It starts large enough
+// for the token it is built from, so it only grows when environment variables
+// expand to something longer than their names.
+typedef struct StrBuilder {
+  char* data;
+  size_t len;
+  size_t cap;
+} StrBuilder;
 
-  for (size_t i = 0; str_arr[i] != NULL; ++i) {
-    size_t size = strlen(str_arr[i]) + 1;
+// Make room for at least n more characters
+static void __reserve(StrBuilder* bld, size_t n) {
+  if (bld->len + n <= bld->cap)
+    return;
 
-    push_back_SizeStack(&ss, size);
-    len += size;
-  }
+  size_t cap = 2 * bld->cap;
 
-  char* ret = (char*) memory_pool_alloc(len + 1);
-  size_t pos = 0;
+  while (cap < bld->len + n)
+    cap <<= 1;
 
-  for (size_t i = 0; str_arr[i] != NULL; ++i) {
-    strcpy(ret + pos, str_arr[i]);
-    pos += pop_front_SizeStack(&ss);
-    ret[pos - 1] = ' ';
-  }
+  char* data = (char*) memory_pool_alloc(cap);
+  memcpy(data, bld->data, bld->len);
 
-  ret[pos] = '\0';
-  destroy_SizeStack(&ss);
+  bld->data = data;
+  bld->cap = cap;
+}
+
+// Copy n characters of str onto the end of the string
+static inline void __append(StrBuilder* bld, const char* str, size_t n) {
+  __reserve(bld, n);
+  memcpy(bld->data + bld->len, str, n);
+  bld->len += n;
+}
 
-  return ret;
+static inline void __append_char(StrBuilder* bld, char c) {
+  __reserve(bld, 1);
+  bld->data[bld->len++] = c;
 }
 
 // Helper for __interpret_deref: Checks if the character is a valid first
@@ -177,55 +218,86 @@ static inline bool __is_identifier_char(char c) {
   return isalnum(c) || c == '_';
 }
 
-// Expand an environment variable onto a string
-static void __interpret_deref(MPStrBuilder* bld, const char* str, int* idx) {
-  assert(str != NULL);
-  assert(str[*idx] == '$');
-  assert(peek_back_MPStrBuilder(bld) == '$');
-
-  // Remove the dereference symbol at the back of the bld deque
-  pop_back_MPStrBuilder(bld);
-
-  StrBuilder tmp = new_StrBuilder(16);
-  char c;
-
-  // Extract the identifier characters. Since this is intended only as a helper
-  // function we assume that interpret_complex_string token has already noticed
-  // a valid first identifier character after the dereference symbol.
-  while (__is_identifier_char((c = str[++(*idx)])))
-    push_back_StrBuilder(&tmp, c);
+// Find the first backslash, single quote, environment variable mark or NUL in
+// str. Dollar signs are also found when dollar is true.
+static size_t __find_special(const char* str, bool dollar) {
+#ifdef __SSE2__
+  // Check 16 bytes at a time. The loads are aligned so they never cross into
+  // a page past the NUL terminator, and bytes before str are masked off.
+  const char* p = (const char*) ((uintptr_t) str & ~(uintptr_t) 15);
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i quote = _mm_set1_epi8('\'');
+  const __m128i deref = _mm_set1_epi8(dollar ? '$' : '\0');
+  const __m128i mark = _mm_set1_epi8(SCRIPT_CACHE_ENV_MARK);
+  const __m128i nul = _mm_setzero_si128();
+  unsigned int mask = 0xffffu << (str - p);
+
+  while (true) {
+    __m128i v = _mm_load_si128((const __m128i*) p);
+    __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, bslash),
+                                            _mm_cmpeq_epi8(v, quote)),
+                               _mm_or_si128(_mm_cmpeq_epi8(v, deref),
+                                            _mm_cmpeq_epi8(v, nul)));
+
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, mark));
+    mask &= _mm_movemask_epi8(hit);
+
+    if (mask != 0)
+      return p + __builtin_ctz(mask) - str;
+
+    p += 16;
+    mask = 0xffffu;
+  }
+#else
+  return strcspn(str, dollar ? "\\'$\x01" : "\\'\x01");
+#endif
+}
 
-  // idx increments one too far in the while loop so bring it back down
-  --(*idx);
+// Keep a reference to the environment variable named right after the '$' at
+// str on the string for run_script() to expand. Returns the number of
+// characters of str consumed.
+static size_t __interpret_deref(StrBuilder* bld, const char* str) {
+  assert(str[0] == '$');
+  assert(__is_first_identifier_char(str[1]));
 
-  // Add the null terminator to the string
-  push_back_StrBuilder(&tmp, '\0');
+  size_t len = 1;
 
-  // Extract the id string and lookup the environment variable
-  char* id = as_array_StrBuilder(&tmp, NULL);
-  const char* env_var = lookup_env(id);
+  while (__is_identifier_char(str[len + 1]))
+    ++len;
 
-  free(id);
+  __append_char(bld, SCRIPT_CACHE_ENV_MARK);
+  __append(bld, str + 1, len);
+  __append_char(bld, SCRIPT_CACHE_ENV_MARK);
 
-  // Append env_var to the string builder
-  if (env_var != NULL) {
-    for (int i = 0; env_var[i] != '\0'; ++i)
-      push_back_MPStrBuilder(bld, env_var[i]);
-  }
+  return len + 1;
 }
 
-// Cleans up escapes and unescaped single quotes and expands environment
+// Cleans up escapes and unescaped single quotes and marks environment
 // variables found in a string
-char* interpret_complex_string_token(const char* str) {
+char* interpret_complex_string_token(char* str) {
   assert(str != NULL);
 
-  MPStrBuilder bld = new_MPStrBuilder(64);
-  int i;
-  int len = strlen(str);
+  size_t i = __find_special(str, true);
+
+  // Most tokens have nothing to interpret and are used in place
+  if (str[i] == '\0')
+    return str;
+
+  size_t len = i + strlen(str + i);
+  StrBuilder bld = { (char*) memory_pool_alloc(len + 1), 0, len + 1 };
   bool in_quotes = false;
 
-  for (i = 0; i <= len; ++i) {
-    push_back_MPStrBuilder(&bld, str[i]);
+  __append(&bld, str, i);
+
+  while (true) {
+    // Copy everything up to the next character that needs interpreting at once
+    size_t run = __find_special(str + i, !in_quotes);
+
+    __append(&bld, str + i, run);
+    i += run;
+
+    if (str[i] == '\0')
+      break;
 
     switch (str[i]) {
     case '\\':                // Remove valid escape characters
@@ -241,32 +313,49 @@ char* interpret_complex_string_token(const char* str) {
         case ';':
         case ' ':
         case '\t':
-          update_back_MPStrBuilder(&bld, str[++i]);
+          __append_char(&bld, str[i+1]);
+          i += 2;
           break;
 
         case '\n':
-          pop_back_MPStrBuilder(&bld);
-          ++i;
+          i += 2;
           break;
 
         default:
+          __append_char(&bld, '\\');
+          ++i;
           break;
         }
       }
       else if (str[i+1] == '\'') {
-        update_back_MPStrBuilder(&bld, '\'');
+        __append_char(&bld, '\'');
+        i += 2;
+      }
+      else {
+        __append_char(&bld, '\\');
         ++i;
       }
       break;
 
     case '\'':                // Remove single quotes and toggle quote state
       in_quotes = !in_quotes;
-      pop_back_MPStrBuilder(&bld);
+      ++i;
       break;
 
     case '$':                 // Try to dereference environment variables
-      if (!in_quotes && __is_first_identifier_char(str[i + 1]))
-        __interpret_deref(&bld, str, &i);
+      if (__is_first_identifier_char(str[i + 1])) {
+        i += __interpret_deref(&bld, str + i);
+      }
+      else {
+        __append_char(&bld, '$');
+        ++i;
+      }
+      break;
+
+    case SCRIPT_CACHE_ENV_MARK: // Keep the character apart from references
+      __append_char(&bld, SCRIPT_CACHE_ENV_MARK);
+      __append_char(&bld, SCRIPT_CACHE_ENV_MARK);
+      ++i;
       break;
 
     default:
@@ -275,11 +364,142 @@ char* interpret_complex_string_token(const char* str) {
   }
 
   // Add a null terminator
-  update_back_MPStrBuilder(&bld, '\0');
+  __append_char(&bld, '\0');
 
   assert(!in_quotes);
 
-  return as_array_MPStrBuilder(&bld, NULL);
+  return bld.data;
+}
+
+// Copy a string into the memory pool with its environment variable references
+// replaced by their current values
+static char* __expand(const char* str) {
+  size_t len = strlen(str);
+  StrBuilder bld = { (char*) memory_pool_alloc(len + 1), 0, len + 1 };
+
+  while (true) {
+    const char* mark = strchrnul(str, SCRIPT_CACHE_ENV_MARK);
+
+    __append(&bld, str, mark - str);
+
+    if (*mark == '\0')
+      break;
+
+    const char* name = mark + 1;
+    size_t name_len = strchrnul(name, SCRIPT_CACHE_ENV_MARK) - name;
+
+    // Two marks in a row are the character itself
+    if (name_len == 0) {
+      __append_char(&bld, SCRIPT_CACHE_ENV_MARK);
+    }
+    else {
+      // Write the terminated name past the end of the string as scratch space
+      // for the lookup. It is overwritten by the value.
+      __reserve(&bld, name_len + 1);
+      memcpy(bld.data + bld.len, name, name_len);
+      bld.data[bld.len + name_len] = '\0';
+
+      const char* val = lookup_env(bld.data + bld.len);
+
+      if (val != NULL)
+        __append(&bld, val, strlen(val));
+    }
+
+    str = name + name_len;
+
+    if (*str == SCRIPT_CACHE_ENV_MARK)
+      ++str;
+  }
+
+  __append_char(&bld, '\0');
+
+  return bld.data;
+}
+
+// Expand a string in place if it refers to environment variables
+static inline void __expand_string(char** str) {
+  if (*str != NULL && strchr(*str, SCRIPT_CACHE_ENV_MARK) != NULL)
+    *str = __expand(*str);
+}
+
+static void __expand_args(char** args) {
+  for (size_t i = 0; args[i] != NULL; ++i)
+    __expand_string(&args[i]);
+}
+
+// Expand the environment variables of every string of a pipeline
+void expand_pipeline_env(CommandHolder* holders) {
+  assert(holders != NULL);
+
+  for (CommandHolder* h = holders; get_command_holder_type(*h) != EOC; ++h) {
+    Command* cmd = &h->cmd;
+
+    switch (get_command_type(*cmd)) {
+    case GENERIC:
+      __expand_args(cmd->generic.args);
+      break;
+
+    case ECHO:
+      __expand_args(cmd->echo.args);
+      break;
+
+    case HASH:
+      __expand_args(cmd->hash.args);
+      break;
+
+    case EXPORT:
+      __expand_string(&cmd->export.env_var);
+      __expand_string(&cmd->export.val);
+      break;
+
+    case CD:
+      __expand_string(&cmd->cd.dir);
+      break;
+
+    case KILL:
+      __expand_string(&cmd->kill.sig_str);
+      __expand_string(&cmd->kill.job_str);
+      break;
+
+    default:
+      break;
+    }
+
+    __expand_string(&h->redirect_in);
+    __expand_string(&h->redirect_out);
+  }
+}
+
+// Mark every command of a pipeline to run in the background
+void set_background(Cmds* pipeline) {
+  CmdsSpan spans[2];
+
+  spans_Cmds(pipeline, spans);
+
+  for (int s = 0; s < 2; ++s)
+    for (size_t i = 0; i < spans[s].len; ++i)
+      spans[s].data[i].flags |= BACKGROUND;
+}
+
+// Put a pipeline and the end of pipeline marker connecting it on the back of a
+// command list
+Cmds append_pipeline(Cmds list, Cmds* pipeline, ListOp op) {
+  CommandHolder eoc = mk_command_holder(NULL, NULL, 0, mk_list_eoc(op));
+
+  // Most lines are a single pipeline, which needs no copying
+  if (is_empty_Cmds(&list)) {
+    push_back_Cmds(pipeline, eoc);
+    return *pipeline;
+  }
+
+  CmdsSpan spans[2];
+
+  spans_Cmds(pipeline, spans);
+  push_back_n_Cmds(&list, spans[0].data, spans[0].len);
+  push_back_n_Cmds(&list, spans[1].data, spans[1].len);
+  push_back_Cmds(&list, eoc);
+
+  return list;
 }
 
 // Build a Redirect structure
@@ -291,24 +511,109 @@ Redirect mk_redirect(char* in, char* out, bool append) {
   };
 }
 
+// Print a message about the input or hand it to the context's callback
+void report_parse_error(ParseContext* ctx, const char* fmt, ...) {
+  char msg[256];
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  if (ctx->on_message != NULL)
+    ctx->on_message(msg);
+  else
+    fputs(msg, stderr);
+}
+
 // Parse a command
 CommandHolder* parse(QuashState* state) {
   assert(state != NULL);
 
-  CommandHolder* holders;
+  // A script file is compiled, or loaded from the cache, all at once
+  if (script_map != NULL && !script_opened) {
+    script_opened = true;
+    script_compiled = open_compiled_script(scanner, script_map, script_len);
+  }
+
+  if (script_compiled)
+    return next_compiled_line();
+
+  if (scanner == NULL)
+    scanner = create_lex();
+
+  ParseContext ctx = { NULL, false, NULL, current_memory_pool() };
+
+  yyparse(scanner, &ctx);
+
+  if (ctx.at_end)
+    end_main_loop();
 
-  yyparse(&holders);
+  return ctx.script;
+}
+
+// Map a script into memory for the lexer to scan in place
+bool parse_from_file(const char* path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    perror("ERROR: Failed to open script");
+
+    if (fd != -1)
+      close(fd);
+
+    return false;
+  }
+
+  // The lexer needs two NUL bytes after the text. Reserve zeroed anonymous
+  // memory for the whole length and lay the file over the front of it, so the
+  // bytes past the end of the file are zero even when it fills its last page.
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = st.st_size;
+  size_t len = (size + 2 + page - 1) & ~(page - 1);
+  char* map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  // The lexer writes into the buffer while it scans, so the file mapping is
+  // private and never changes the script on disk
+  if (map != MAP_FAILED && size > 0 &&
+      mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+           fd, 0) == MAP_FAILED) {
+    munmap(map, len);
+    map = MAP_FAILED;
+  }
 
-  if (holders != NULL) {
-    CmdStrs strs = new_CmdStrs(10);
-    __stringify_script(holders, &strs);
-    state->parsed_str = __condense_string_array(as_array_CmdStrs(&strs, NULL));
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    perror("ERROR: Failed to map script");
+    return false;
   }
 
-  return holders;
+  madvise(map, len, MADV_SEQUENTIAL);
+
+  script_map = map;
+  script_map_len = len;
+  script_len = size;
+
+  if (scanner == NULL)
+    scanner = create_lex();
+
+  return lex_scan_buffer(scanner, script_map, size + 2);
 }
 
 // Clean up dynamically allocated memory in the parser
 void destroy_parser() {
-  destroy_lex();
+  if (scanner != NULL) {
+    destroy_lex(scanner);
+    scanner = NULL;
+  }
+
+  close_compiled_script();
+
+  if (script_map != NULL) {
+    munmap(script_map, script_map_len);
+    script_map = NULL;
+  }
 }
@@ -12,6 +12,7 @@
 
 #include "command.h"
 #include "deque.h"
+#include "memory_pool.h"
 #include "quash.h"
 
 /**
@@ -44,10 +45,42 @@ IMPLEMENT_DEQUE_STRUCT(CmdStrs, char*);
  */
 IMPLEMENT_DEQUE_STRUCT(Cmds, CommandHolder);
 
-PROTOTYPE_DEQUE(CmdStrs, char*);
-PROTOTYPE_DEQUE(Cmds, CommandHolder);
+IMPLEMENT_DEQUE_MEMORY_POOL(CmdStrs, char*);
+IMPLEMENT_DEQUE_MEMORY_POOL(Cmds, CommandHolder);
+
+// Handle of a scanner generated by flex, declared the same way flex does
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
 /** @endcond Doxygen_Suppress */
 
+/**
+ * @brief Everything one call to the parser reads and produces
+ *
+ * The parser is pure and the lexer reentrant. Each call to yyparse() is given
+ * a scanner and a context, and the parser allocates from the context's memory
+ * pool. Environment variables are only marked, never looked up, so a call
+ * touches no state besides these and the function in @a on_message. Separate
+ * threads can call yyparse() at the same time as long as each has a scanner
+ * and a pool of its own and @a on_message is safe to call from any of them.
+ *
+ * @warning parse() keeps the scanner and the script of the main loop in
+ * static variables and may only be called from the main thread.
+ *
+ * @sa parse()
+ */
+typedef struct ParseContext {
+  CommandHolder* script; /**< Command list of the line that was parsed or NULL
+                          * if it held no commands */
+  bool at_end;           /**< Set once the end of the input is reached */
+  void (*on_message)(const char* msg); /**< Called with each message about the
+                                        * input instead of printing it, unless
+                                        * it is NULL */
+  MemoryPool* pool;      /**< Pool the parse allocates from. It becomes the
+                          * current pool of the calling thread. */
+} ParseContext;
+
 
 /*************************************************************
  * Functions used by the parser
@@ -72,33 +105,115 @@ Redirect mk_redirect(char* in, char* out, bool append);
 
 /**
  * @brief Clean up a string by removing escape symbols and unescaped single
- * quotes. Also expands any environment variables.
+ * quotes. Environment variables are marked with @a SCRIPT_CACHE_ENV_MARK for
+ * expand_pipeline_env() to expand when the pipeline runs.
+ *
+ * @param str The string to clean up. It is returned as is when there is nothing
+ * to clean up, so it must live at least as long as the result.
+ *
+ * @return The cleaned up string allocated on the @a MemoryPool
+ *
+ * @sa MemoryPool, expand_pipeline_env()
+ */
+char* interpret_complex_string_token(char* str);
+
+/**
+ * @brief Expand the environment variables marked in the strings of a pipeline
+ *
+ * Strings that refer to environment variables are replaced with copies holding
+ * the current values, allocated on the @a MemoryPool. Called just before the
+ * pipeline runs, so a variable set by an earlier pipeline of the same line is
+ * seen. It reads the environment of quash, so unlike the parser it belongs to
+ * the main thread.
+ *
+ * @param holders The commands of the pipeline, ended by an @a EOC command
+ *
+ * @sa interpret_complex_string_token(), SCRIPT_CACHE_ENV_MARK
+ */
+void expand_pipeline_env(CommandHolder* holders);
+
+/**
+ * @brief Set the @a BACKGROUND flag of every command in a pipeline
+ *
+ * @param pipeline The commands of the pipeline
+ */
+void set_background(Cmds* pipeline);
+
+/**
+ * @brief Append a pipeline to the back of a command list
+ *
+ * The pipeline is followed by an @a EOCCommand holding @a op. A list that is
+ * still empty is dropped and the pipeline itself becomes the list.
+ *
+ * @param list The command list so far
+ *
+ * @param pipeline The commands of the pipeline
+ *
+ * @param op How the pipeline connects to the pipeline appended after it
+ *
+ * @return The extended command list
  *
- * @param str The string to clean up
+ * @sa ListOp, EOCCommand
+ */
+Cmds append_pipeline(Cmds list, Cmds* pipeline, ListOp op);
+
+/**
+ * @brief Report a problem with the input found by the lexer or parser
  *
- * @return The cleaned up and expanded string allocated on the @a MemoryPool
+ * The message is printed to standard error unless the context has a
+ * @a on_message callback to take it instead.
  *
- * @sa MemoryPool
+ * @param ctx Context of the parser call the problem was found in
+ *
+ * @param fmt printf() style format string
+ *
+ * @sa ParseContext
  */
-char* interpret_complex_string_token(const char* str);
+void report_parse_error(ParseContext* ctx, const char* fmt, ...)
+  __attribute__ ((format (printf, 2, 3)));
 
 
 /*************************************************************
  * Functions used by the parser
  *************************************************************/
 /**
- * @brief Handles the call to the parser and provides a string equivalent of the
- * @a Command structure to @a QuashState
+ * @brief Handles the call to the parser
  *
- * @param[out] state The state of the quash shell. The parsed_str member of
- * QuashState is set to the stringified command structure.
+ * @param state The state of the quash shell
  *
- * @return A pointer to the parsed command structure
+ * @return A pointer to the parsed command list. Every pipeline of the list is
+ * ended by an @a EOCCommand.
  *
  * @sa CommandHolder, QuashState
  */
 CommandHolder* parse(QuashState* state);
 
+/**
+ * @brief Build a string approximating what the user typed for a pipeline
+ *
+ * @note The free function must be called on the result eventually
+ *
+ * @param holders The first command of the pipeline
+ *
+ * @return The command string allocated with malloc()
+ */
+char* stringify_pipeline(const CommandHolder* holders);
+
+/**
+ * @brief Make the parser read commands from a script file instead of standard
+ * in
+ *
+ * The file is mapped into memory once and the lexer scans the mapping in place,
+ * so no line of the script is copied through stdio buffers. The first call to
+ * @a parse() compiles the whole script, or loads its compiled form from the
+ * cache, and each call returns the next line from it.
+ *
+ * @param path Path to the script to run
+ *
+ * @return True if the script was mapped and false otherwise
+ */
+bool parse_from_file(const char* path);
+
 /**
  * @brief Cleanup memory dynamically allocated by the parser
  */
@@ -0,0 +1,735 @@
+/**
+ * @file script_cache.c
+ *
+ * @brief Compiles script files and keeps the compiled form in an on disk cache
+ */
+
+#define _GNU_SOURCE
+
+#include "script_cache.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "execute.h"
+#include "memory_pool.h"
+#include "parse.tab.h"
+#include "quash.h"
+
+// Changed whenever the layout or meaning of the records, or the way the lexer
+// splits a script into them, changes so cache files written by other versions
+// of quash are compiled again
+#define SCRIPT_CACHE_VERSION (5)
+
+// Number of compiled scripts kept in the cache directory. Saving another one
+// removes the ones used least recently.
+#define SCRIPT_CACHE_MAX_FILES (64)
+
+// A hit only refreshes the modification time that marks when a compiled script
+// was last used if it is older than this, so most runs write nothing
+#define SCRIPT_CACHE_TOUCH_AFTER (24 * 60 * 60)
+
+// Temporary files older than this were left behind by a quash that did not
+// finish saving and are removed
+#define SCRIPT_CACHE_TMP_AGE (60 * 60)
+
+// String reference standing for a NULL string. Every other reference is the
+// offset of the string in the string table.
+#define NO_REF (UINT32_MAX)
+
+// Layout of a compiled script:
+//
+//   CacheHeader | CachedLine[n_lines] | CachedHolder[n_holders] |
+//   uint32_t words[n_words] | char strings[str_len] | char text[text_len]
+//
+// Every record only refers to others by index or offset, so a cache file can
+// be mapped anywhere and used in place. The script text the records were
+// compiled from is stored last. A cache file is only used for a script with
+// exactly that text, the hash in the file name just finds it.
+typedef struct CacheHeader {
+  char magic[4];      // "QSHC"
+  uint32_t version;   // SCRIPT_CACHE_VERSION
+  uint64_t text_hash; // Hash of the script text
+  uint64_t text_len;  // Length of the script text
+  uint32_t n_lines;
+  uint32_t n_holders;
+  uint32_t n_words;
+  uint32_t str_len;
+} CacheHeader;
+
+// Result of one call to the parser
+typedef struct CachedLine {
+  uint32_t first;   // Index of the first command or NO_REF for no commands
+  uint32_t message; // String reference of the parser messages for the line
+} CachedLine;
+
+typedef struct CachedHolder {
+  uint8_t type;          // CommandType
+  uint8_t flags;         // CommandHolder flags
+  uint8_t next;          // ListOp of an EOC command
+  uint8_t pad;
+  uint32_t redirect_in;  // String reference
+  uint32_t redirect_out; // String reference
+  uint32_t words;        // Index of the first string of the command
+  uint32_t n_words;      // Number of strings of the command
+} CachedHolder;
+
+// Growable byte array the compiler appends records to
+typedef struct ByteBuf {
+  char* data;
+  size_t len;
+  size_t cap;
+} ByteBuf;
+
+static const char cache_magic[4] = { 'Q', 'S', 'H', 'C' };
+
+// The compiled script being run. It is either a mapped cache file or the
+// malloc'd output of the compiler.
+static char* blob = NULL;
+static size_t blob_len = 0;
+static bool blob_mapped = false;
+
+static const CacheHeader* header;
+static const CachedLine* lines;
+static const CachedHolder* holders;
+static const uint32_t* words;
+static const char* strs;
+static uint32_t next_line = 0;
+
+// Compiler output
+static ByteBuf out_lines;
+static ByteBuf out_holders;
+static ByteBuf out_words;
+static ByteBuf out_strs;
+static ByteBuf out_message;
+static ByteBuf out_text;
+
+/**************************************************************************
+ * Compiling
+ **************************************************************************/
+// Append len bytes to a buffer and return the offset they were written at
+static size_t __push(ByteBuf* buf, const void* data, size_t len) {
+  if (len == 0)
+    return buf->len;
+
+  if (buf->len + len > buf->cap) {
+    size_t cap = buf->cap == 0 ? 4096 : 2 * buf->cap;
+
+    while (cap < buf->len + len)
+      cap <<= 1;
+
+    if ((buf->data = realloc(buf->data, cap)) == NULL) {
+      fprintf(stderr, "ERROR: Failed to allocate compiled script\n");
+      exit(-1);
+    }
+
+    buf->cap = cap;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+
+  return buf->len - len;
+}
+
+static void __free_buf(ByteBuf* buf) {
+  free(buf->data);
+  *buf = (ByteBuf) { NULL, 0, 0 };
+}
+
+// Copy a string into the string table and return a reference to it
+static uint32_t __add_string(const char* str) {
+  if (str == NULL)
+    return NO_REF;
+
+  size_t off = __push(&out_strs, str, strlen(str) + 1);
+
+  if (off >= NO_REF) {
+    fprintf(stderr, "ERROR: Script is too large to compile\n");
+    exit(-1);
+  }
+
+  return off;
+}
+
+static void __add_word(const char* str) {
+  uint32_t ref = __add_string(str);
+
+  __push(&out_words, &ref, sizeof(ref));
+}
+
+static void __add_args(char** args) {
+  for (size_t i = 0; args[i] != NULL; ++i)
+    __add_word(args[i]);
+}
+
+static void __compile_holder(const CommandHolder* holder) {
+  Command cmd = holder->cmd;
+  CachedHolder rec = {
+    get_command_type(cmd),
+    holder->flags,
+    LIST_END,
+    0,
+    __add_string(holder->redirect_in),
+    __add_string(holder->redirect_out),
+    out_words.len / sizeof(uint32_t),
+    0
+  };
+
+  switch (get_command_type(cmd)) {
+  case GENERIC:
+  case ECHO:
+  case HASH:
+    __add_args(cmd.generic.args);
+    break;
+
+  case EXPORT:
+    __add_word(cmd.export.env_var);
+    __add_word(cmd.export.val);
+    break;
+
+  case CD:
+    if (cmd.cd.dir != NULL)
+      __add_word(cmd.cd.dir);
+    break;
+
+  case KILL:
+    __add_word(cmd.kill.sig_str);
+    __add_word(cmd.kill.job_str);
+    break;
+
+  case EOC:
+    rec.next = cmd.eoc.next;
+    break;
+
+  default:
+    break;
+  }
+
+  rec.n_words = out_words.len / sizeof(uint32_t) - rec.words;
+  __push(&out_holders, &rec, sizeof(rec));
+}
+
+// Store what the parser returned for one line along with its messages
+static void __compile_line(const CommandHolder* script) {
+  CachedLine line = { NO_REF, NO_REF };
+
+  if (script != NULL) {
+    line.first = out_holders.len / sizeof(CachedHolder);
+
+    for (size_t i = 0; ; ++i) {
+      __compile_holder(&script[i]);
+
+      if (get_command_holder_type(script[i]) == EOC &&
+          script[i].cmd.eoc.next == LIST_END)
+        break;
+    }
+  }
+
+  if (out_message.len > 0) {
+    __push(&out_message, "", 1);
+    line.message = __add_string(out_message.data);
+    out_message.len = 0;
+  }
+
+  __push(&out_lines, &line, sizeof(line));
+}
+
+// Keep a parser message to print when the line being compiled runs
+static void __add_message(const char* msg) {
+  __push(&out_message, msg, strlen(msg));
+}
+
+// Run the parser over the whole script. The memory pool is rewound after each
+// line just like the main loop does.
+static void __compile(yyscan_t scanner) {
+  ParseContext ctx = { NULL, false, __add_message, current_memory_pool() };
+
+  while (!ctx.at_end) {
+    ctx.script = NULL;
+
+    yyparse(scanner, &ctx);
+    __compile_line(ctx.script);
+
+    reset_memory_pool();
+  }
+}
+
+// Put the compiled records together behind a header and in front of the text
+static void __link(uint64_t hash, size_t text_len) {
+  CacheHeader h = {
+    { cache_magic[0], cache_magic[1], cache_magic[2], cache_magic[3] },
+    SCRIPT_CACHE_VERSION,
+    hash,
+    text_len,
+    out_lines.len / sizeof(CachedLine),
+    out_holders.len / sizeof(CachedHolder),
+    out_words.len / sizeof(uint32_t),
+    out_strs.len
+  };
+  ByteBuf out = { NULL, 0, 0 };
+
+  __push(&out, &h, sizeof(h));
+  __push(&out, out_lines.data, out_lines.len);
+  __push(&out, out_holders.data, out_holders.len);
+  __push(&out, out_words.data, out_words.len);
+  __push(&out, out_strs.data, out_strs.len);
+  __push(&out, out_text.data, out_text.len);
+
+  __free_buf(&out_lines);
+  __free_buf(&out_holders);
+  __free_buf(&out_words);
+  __free_buf(&out_strs);
+  __free_buf(&out_message);
+  __free_buf(&out_text);
+
+  blob = out.data;
+  blob_len = out.len;
+  blob_mapped = false;
+}
+
+/**************************************************************************
+ * Loading
+ **************************************************************************/
+static bool __valid_ref(uint32_t ref) {
+  return ref == NO_REF || ref < header->str_len;
+}
+
+// Check that a command record only refers to records that exist and has the
+// strings its type needs
+static bool __valid_holder(const CachedHolder* rec) {
+  if (!__valid_ref(rec->redirect_in) || !__valid_ref(rec->redirect_out) ||
+      rec->words > header->n_words ||
+      rec->n_words > header->n_words - rec->words)
+    return false;
+
+  for (uint32_t i = 0; i < rec->n_words; ++i)
+    if (words[rec->words + i] == NO_REF ||
+        !__valid_ref(words[rec->words + i]))
+      return false;
+
+  switch (rec->type) {
+  case GENERIC:
+  case HASH:
+    return rec->n_words >= 1;
+
+  case EXPORT:
+  case KILL:
+    return rec->n_words == 2;
+
+  case CD:
+    return rec->n_words <= 1;
+
+  case EOC:
+    return rec->next <= LIST_OR;
+
+  case ECHO:
+  case PWD:
+  case JOBS:
+  case EXIT:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// Point the record tables into a compiled script after checking that it was
+// compiled from the given text and that following its records can never read
+// outside of it
+static bool __attach(const char* data, size_t size, uint64_t hash,
+                     const char* text, size_t text_len) {
+  header = (const CacheHeader*) data;
+
+  if (size < sizeof(CacheHeader) ||
+      memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 ||
+      header->version != SCRIPT_CACHE_VERSION ||
+      header->text_hash != hash || header->text_len != text_len ||
+      header->n_lines == 0)
+    return false;
+
+  size_t expected = sizeof(CacheHeader) +
+    (size_t) header->n_lines * sizeof(CachedLine) +
+    (size_t) header->n_holders * sizeof(CachedHolder) +
+    (size_t) header->n_words * sizeof(uint32_t) +
+    header->str_len + text_len;
+
+  if (size != expected)
+    return false;
+
+  lines = (const CachedLine*) (header + 1);
+  holders = (const CachedHolder*) (lines + header->n_lines);
+  words = (const uint32_t*) (holders + header->n_holders);
+  strs = (const char*) (words + header->n_words);
+
+  if (memcmp(strs + header->str_len, text, text_len) != 0)
+    return false;
+
+  if (header->str_len > 0 && strs[header->str_len - 1] != '\0')
+    return false;
+
+  for (uint32_t i = 0; i < header->n_lines; ++i)
+    if ((lines[i].first != NO_REF && lines[i].first >= header->n_holders) ||
+        !__valid_ref(lines[i].message))
+      return false;
+
+  for (uint32_t i = 0; i < header->n_holders; ++i)
+    if (!__valid_holder(&holders[i]))
+      return false;
+
+  // Every line is read up to an EOC ending the list. The last record has to be
+  // one so no line runs off the end.
+  if (header->n_holders > 0) {
+    const CachedHolder* last = &holders[header->n_holders - 1];
+
+    if (last->type != EOC || last->next != LIST_END)
+      return false;
+  }
+
+  next_line = 0;
+
+  return true;
+}
+
+// FNV-1a hash of the script text
+static uint64_t __hash_text(const char* text, size_t len) {
+  uint64_t x = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < len; ++i) {
+    x ^= (unsigned char) text[i];
+    x *= 0x100000001b3ULL;
+  }
+
+  return x;
+}
+
+// Directory the compiled scripts are kept in
+static bool __cache_dir(char* dir, size_t size) {
+  const char* base = lookup_env("XDG_CACHE_HOME");
+  int len;
+
+  if (base != NULL && base[0] == '/') {
+    len = snprintf(dir, size, "%s/quash", base);
+  }
+  else if ((base = lookup_env("HOME")) != NULL) {
+    len = snprintf(dir, size, "%s/.cache/quash", base);
+  }
+  else {
+    return false;
+  }
+
+  return len > 0 && (size_t) len < size;
+}
+
+// Map the cache file at path if it holds the compiled form of the script
+static bool __load(const char* path, uint64_t hash, const char* text,
+                   size_t text_len) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd == -1)
+    return false;
+
+  if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  if (!__attach(map, st.st_size, hash, text, text_len)) {
+    munmap(map, st.st_size);
+    close(fd);
+    return false;
+  }
+
+  // Mark the file as used so eviction keeps it
+  if (time(NULL) - st.st_mtime > SCRIPT_CACHE_TOUCH_AFTER)
+    futimens(fd, NULL);
+
+  close(fd);
+
+  blob = map;
+  blob_len = st.st_size;
+  blob_mapped = true;
+
+  return true;
+}
+
+// A file in the cache directory and when it was last used
+typedef struct CacheEntry {
+  char name[NAME_MAX + 1];
+  time_t used;
+} CacheEntry;
+
+// Orders cache entries from the least to the most recently used
+static int __compare_entries(const void* a, const void* b) {
+  time_t x = ((const CacheEntry*) a)->used;
+  time_t y = ((const CacheEntry*) b)->used;
+
+  return (x > y) - (x < y);
+}
+
+// Make room for one more compiled script by removing the least recently used
+// ones, along with temporary files that were never renamed into place
+static void __evict(const char* dir) {
+  DIR* d = opendir(dir);
+
+  if (d == NULL)
+    return;
+
+  CacheEntry* entries = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+  time_t now = time(NULL);
+  struct dirent* ent;
+
+  while ((ent = readdir(d)) != NULL) {
+    const char* ext = strstr(ent->d_name, ".qshc");
+    struct stat st;
+
+    if (ext == NULL ||
+        fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+        !S_ISREG(st.st_mode))
+      continue;
+
+    if (ext[5] != '\0') {
+      if (now - st.st_mtime > SCRIPT_CACHE_TMP_AGE)
+        unlinkat(dirfd(d), ent->d_name, 0);
+
+      continue;
+    }
+
+    if (len == cap) {
+      cap = cap == 0 ? SCRIPT_CACHE_MAX_FILES : 2 * cap;
+
+      CacheEntry* grown = realloc(entries, cap * sizeof(CacheEntry));
+
+      if (grown == NULL)
+        break;
+
+      entries = grown;
+    }
+
+    strcpy(entries[len].name, ent->d_name);
+    entries[len].used = st.st_mtime;
+    ++len;
+  }
+
+  if (len >= SCRIPT_CACHE_MAX_FILES) {
+    qsort(entries, len, sizeof(CacheEntry), __compare_entries);
+
+    for (size_t i = 0; i <= len - SCRIPT_CACHE_MAX_FILES; ++i)
+      unlinkat(dirfd(d), entries[i].name, 0);
+  }
+
+  free(entries);
+  closedir(d);
+}
+
+// Write the compiled script to the cache. It is written to a temporary file
+// first and renamed into place, so a quash running the same script at the same
+// time never maps a partly written file. The cache is only an optimization, so
+// failures are silently ignored.
+static void __save(const char* dir, const char* path) {
+  char tmp[PATH_MAX];
+
+  // Create the cache directory and the directory above it if they are missing
+  char* slash = strrchr(dir, '/');
+
+  if (slash != NULL && slash != dir) {
+    *slash = '\0';
+    mkdir(dir, 0700);
+    *slash = '/';
+  }
+
+  mkdir(dir, 0700);
+
+  __evict(dir);
+
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int) sizeof(tmp))
+    return;
+
+  int fd = mkstemp(tmp);
+
+  if (fd == -1)
+    return;
+
+  size_t written = 0;
+
+  while (written < blob_len) {
+    ssize_t n = write(fd, blob + written, blob_len - written);
+
+    if (n <= 0)
+      break;
+
+    written += n;
+  }
+
+  if (close(fd) == -1 || written < blob_len || rename(tmp, path) == -1)
+    unlink(tmp);
+}
+
+/**************************************************************************
+ * Running
+ **************************************************************************/
+// Strings are used straight from the compiled script. Their environment
+// variables are expanded by run_script() like those of any other line.
+static char* __get_string(uint32_t ref) {
+  return ref == NO_REF ? NULL : (char*) strs + ref;
+}
+
+static CommandHolder __build_holder(const CachedHolder* rec) {
+  char** args = (char**) memory_pool_alloc((rec->n_words + 1) * sizeof(char*));
+  Command cmd;
+
+  for (uint32_t i = 0; i < rec->n_words; ++i)
+    args[i] = __get_string(words[rec->words + i]);
+
+  args[rec->n_words] = NULL;
+
+  switch (rec->type) {
+  case GENERIC:
+    cmd = mk_generic_command(args);
+    break;
+
+  case ECHO:
+    cmd = mk_echo_command(args);
+    break;
+
+  case HASH:
+    cmd = mk_hash_command(args);
+    break;
+
+  case EXPORT:
+    cmd = mk_export_command(args[0], args[1]);
+    break;
+
+  case CD:
+    cmd = mk_cd_command(args[0]);
+    break;
+
+  case KILL:
+    cmd = mk_kill_command(args[0], args[1]);
+    break;
+
+  case PWD:
+    cmd = mk_pwd_command();
+    break;
+
+  case JOBS:
+    cmd = mk_jobs_command();
+    break;
+
+  case EXIT:
+    cmd = mk_exit_command();
+    break;
+
+  default:
+    cmd = mk_list_eoc(rec->next);
+    break;
+  }
+
+  return mk_command_holder(__get_string(rec->redirect_in),
+                           __get_string(rec->redirect_out),
+                           rec->flags, cmd);
+}
+
+/**************************************************************************
+ * Public Functions
+ **************************************************************************/
+// Load the compiled script from the cache or compile it and cache the result
+bool open_compiled_script(yyscan_t scanner, const char* text, size_t len) {
+  assert(blob == NULL);
+
+  uint64_t hash = __hash_text(text, len);
+  char dir[PATH_MAX];
+  char path[PATH_MAX];
+  const char* no_cache = lookup_env("QUASH_NO_SCRIPT_CACHE");
+  bool cacheable = (no_cache == NULL || no_cache[0] == '\0') &&
+    __cache_dir(dir, sizeof(dir)) &&
+    snprintf(path, sizeof(path), "%s/%016llx.qshc", dir,
+             (unsigned long long) hash) < (int) sizeof(path);
+
+  if (cacheable && __load(path, hash, text, len))
+    return true;
+
+  // The lexer terminates words inside the text it scans, so the text is
+  // copied first
+  __push(&out_text, text, len);
+
+  __compile(scanner);
+  __link(hash, len);
+
+  // Only the copy at the end of the compiled script is still the original
+  if (!__attach(blob, blob_len, hash, blob + blob_len - len, len)) {
+    fprintf(stderr, "ERROR: Failed to compile script\n");
+    exit(-1);
+  }
+
+  if (cacheable)
+    __save(dir, path);
+
+  return true;
+}
+
+// Build the commands of the next line from its records
+CommandHolder* next_compiled_line() {
+  assert(blob != NULL);
+  assert(next_line < header->n_lines);
+
+  const CachedLine* line = &lines[next_line++];
+
+  if (line->message != NO_REF)
+    fputs(strs + line->message, stderr);
+
+  // parse() ends the main loop once it reaches the end of the script
+  if (next_line == header->n_lines)
+    end_main_loop();
+
+  if (line->first == NO_REF)
+    return NULL;
+
+  const CachedHolder* rec = &holders[line->first];
+  size_t len = 1;
+
+  while (rec[len - 1].type != EOC || rec[len - 1].next != LIST_END)
+    ++len;
+
+  CommandHolder* script =
+    (CommandHolder*) memory_pool_alloc(len * sizeof(CommandHolder));
+
+  for (size_t i = 0; i < len; ++i)
+    script[i] = __build_holder(&rec[i]);
+
+  return script;
+}
+
+// Release the compiled script
+void close_compiled_script() {
+  if (blob == NULL)
+    return;
+
+  if (blob_mapped)
+    munmap(blob, blob_len);
+  else
+    free(blob);
+
+  blob = NULL;
+  blob_len = 0;
+}
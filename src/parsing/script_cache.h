@@ -0,0 +1,85 @@
+/**
+ * @file script_cache.h
+ *
+ * @brief Compiled form of script files that is cached on disk so a script is
+ * only lexed and parsed the first time it is run.
+ *
+ * A script run with `quash -f` is parsed in full before its first line runs.
+ * Each line is stored as flat, position independent records of commands,
+ * argument lists and strings, and the result is written to
+ * `$XDG_CACHE_HOME/quash` (or `$HOME/.cache/quash`) in a file named after a
+ * hash of the script text, together with the text itself. Later runs of the
+ * same text map that file and build the @a CommandHolder array of each line
+ * straight from it without calling yyparse(). The file is only used if the
+ * text stored in it is the script's. Only the most recently used compiled
+ * scripts are kept, older ones are removed to make room for new ones. Setting
+ * `QUASH_NO_SCRIPT_CACHE` to anything but the empty string stops quash from
+ * reading or writing the cache.
+ *
+ * The parser never expands environment variables. A reference to one is kept
+ * in the string as @a SCRIPT_CACHE_ENV_MARK, the name and another @a
+ * SCRIPT_CACHE_ENV_MARK, so compiled strings stay valid whatever the
+ * environment. run_script() expands them just before each pipeline runs.
+ * Messages the parser prints about a line are kept as well and printed when
+ * that line is reached.
+ */
+
+#ifndef SRC_PARSING_SCRIPT_CACHE_H
+#define SRC_PARSING_SCRIPT_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "command.h"
+#include "parsing_interface.h"
+
+/**
+ * @def SCRIPT_CACHE_ENV_MARK
+ *
+ * @brief Character placed around the name of an environment variable whose
+ * expansion is deferred until the pipeline runs
+ *
+ * The character itself is kept in a string as two of them in a row, which
+ * stands for an empty name.
+ *
+ * @sa expand_pipeline_env()
+ */
+#define SCRIPT_CACHE_ENV_MARK ('\x01')
+
+/**
+ * @brief Prepare a script to be run from its compiled form
+ *
+ * The compiled form is loaded from the cache when there is one for @a text.
+ * Otherwise the lexer, which must already be scanning @a text, is run over the
+ * whole script and the result is saved to the cache for next time.
+ *
+ * @param scanner The lexer scanning @a text
+ *
+ * @param text The script text
+ *
+ * @param len Length of @a text in bytes
+ *
+ * @return True if the script is now run from its compiled form and false if it
+ * has to be parsed line by line instead
+ */
+bool open_compiled_script(yyscan_t scanner, const char* text, size_t len);
+
+/**
+ * @brief Build the commands of the next line of the compiled script
+ *
+ * Reaching the last line ends the main loop just like @a parse() does at the
+ * end of a script.
+ *
+ * @return The command list of the line allocated on the @a MemoryPool or NULL
+ * if the line holds no commands
+ *
+ * @sa parse()
+ */
+CommandHolder* next_compiled_line();
+
+/**
+ * @brief Release the compiled script
+ */
+void close_compiled_script();
+
+#endif // SRC_PARSING_SCRIPT_CACHE_H
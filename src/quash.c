@@ -31,50 +31,65 @@ static QuashState state;
 static QuashState initial_state() {
   return (QuashState) {
     true,
-    isatty(STDIN_FILENO),
-    NULL
+    isatty(STDIN_FILENO)
   };
 }
 
-// Print a prompt for a command
-static void print_prompt() {
-  bool should_free = true;
-  char* cwd = get_current_directory(&should_free);
+// Prompt shown before each command. It only changes when the working directory
+// does, so it is rendered once and written out as is until then.
+static char prompt[sizeof("[QUASH - @ ]$ ") + LOGIN_NAME_MAX + HOST_NAME_MAX +
+                   NAME_MAX];
+static size_t prompt_len = 0;
 
-  assert(cwd != NULL);
+// Render the prompt for the current user, host and working directory
+static void render_prompt() {
+  static char hostname[HOST_NAME_MAX + 1];
+  static char* username = NULL;
 
-  char hostname[HOST_NAME_MAX];
+  // The user and host never change while quash runs
+  if (hostname[0] == '\0') {
+    gethostname(hostname, HOST_NAME_MAX);
 
-  // Get the hostname
-  gethostname(hostname, HOST_NAME_MAX);
+    // Remove first period and everything afterwards
+    hostname[strcspn(hostname, ".")] = '\0';
 
-  // Remove first period and everything afterwards
-  for (int i = 0; hostname[i] != '\0'; ++i) {
-    if (hostname[i] == '.') {
-      hostname[i] = '\0';
-      break;
-    }
+    username = getlogin();
   }
 
-  char* last_dir = cwd;
+  bool should_free = true;
+  char* cwd = get_current_directory(&should_free);
+
+  assert(cwd != NULL);
+
   // Show only last directory
-  for (int i = 0; cwd[i] != '\0'; ++i) {
-    if (cwd[i] == '/' && cwd[i + 1] != '\0') {
-      last_dir = cwd + i + 1;
-    }
-  }
+  char* last_dir = strrchr(cwd, '/');
 
-  char* username = getlogin();
+  if (last_dir == NULL || last_dir[1] == '\0')
+    last_dir = cwd;
+  else
+    ++last_dir;
 
-  // print the prompt
-  printf("[QUASH - %s@%s %s]$ ", username, hostname, last_dir);
+  int len = snprintf(prompt, sizeof(prompt), "[QUASH - %s@%s %s]$ ",
+                     username, hostname, last_dir);
 
-  fflush(stdout);
+  prompt_len = len < (int) sizeof(prompt) ? len : sizeof(prompt) - 1;
 
   if (should_free)
     free(cwd);
 }
 
+// Print a prompt for a command
+static void print_prompt() {
+  if (prompt_len == 0)
+    render_prompt();
+
+  // Anything printed through stdio has to come out before the prompt
+  fflush(stdout);
+
+  if (write(STDOUT_FILENO, prompt, prompt_len) == -1)
+    perror("ERROR: Failed to print prompt");
+}
+
 /**************************************************************************
  * Public Functions
  **************************************************************************/
@@ -83,9 +98,9 @@ bool is_running() {
   return state.running;
 }
 
-// Get a copy of the string
-char* get_command_string() {
-  return strdup(state.parsed_str);
+// Render the prompt again before it is next printed
+void invalidate_prompt() {
+  prompt_len = 0;
 }
 
 // Check if Quash is receiving input from the command line or not
@@ -110,6 +125,24 @@ void end_main_loop() {
 int main(int argc, char** argv) {
   state = initial_state();
 
+  int opt;
+
+  // quash -f script.qsh runs a script without going through standard in
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    switch (opt) {
+    case 'f':
+      if (!parse_from_file(optarg))
+        return EXIT_FAILURE;
+
+      state.is_a_tty = false;
+      break;
+
+    default:
+      fprintf(stderr, "Usage: %s [-f script]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
   if (is_tty()) {
     puts("Welcome to Quash!");
     puts("Type \"exit\" or \"quit\" to quit");
@@ -117,21 +150,28 @@ int main(int argc, char** argv) {
     fflush(stdout);
   }
 
+  atexit(destroy_env);
   atexit(destroy_parser);
   atexit(destroy_memory_pool);
 
+  // One pool serves every command. It is rewound after each one instead of
+  // being freed and allocated again.
+  initialize_memory_pool(1024);
+
   // Main execution loop
   while (is_running()) {
+    // Report background jobs that finished while the last command ran
+    check_jobs_bg_status();
+
     if (is_tty())
       print_prompt();
 
-    initialize_memory_pool(1024);
     CommandHolder* script = parse(&state);
 
     if (script != NULL)
       run_script(script);
 
-    destroy_memory_pool();
+    reset_memory_pool();
   }
 
   return EXIT_SUCCESS;
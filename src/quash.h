@@ -20,8 +20,6 @@ typedef struct QuashState {
   bool running;     /**< Indicates if Quash should keep accept more input */
   bool is_a_tty;    /**< Indicates if the shell is receiving input from a file
                      * or the command line */
-  char* parsed_str; /**< Holds a string representing the parsed structure of the
-                     * command input from the command line */
 } QuashState;
 
 /**
@@ -32,13 +30,10 @@ typedef struct QuashState {
 bool is_tty();
 
 /**
- * @brief Get a deep copy of the current command string
- *
- * @note The free function must be called on the result eventually
- *
- * @return A copy of the command string
+ * @brief Note that the working directory changed so the prompt is rendered
+ * again before it is next printed
  */
-char* get_command_string();
+void invalidate_prompt();
 
 /**
  * @brief Query if quash should accept more input or not.
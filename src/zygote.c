@@ -0,0 +1,350 @@
+/**
+ * @file zygote.c
+ *
+ * @brief Implements the helper process that starts the processes of builtins
+ */
+
+#define _GNU_SOURCE
+
+#include "zygote.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Flags of ZygoteRequest.fds telling which descriptors came with a request
+#define ZYGOTE_FD_IN   (1 << 0)
+#define ZYGOTE_FD_OUT  (1 << 1)
+#define ZYGOTE_FD_GATE (1 << 2)
+
+// Stack a new process runs on. Every process has its own copy of it.
+#define ZYGOTE_STACK_SIZE (64 * 1024)
+
+/**
+ * @brief A launch request. The output follows it on the socket.
+ */
+typedef struct ZygoteRequest {
+  pid_t pgid; /**< Process group to join or 0 to lead a new one */
+  int fds;    /**< @a ZYGOTE_FD_IN, @a ZYGOTE_FD_OUT and @a ZYGOTE_FD_GATE
+               *   for the descriptors passed with the request, in that
+               *   order */
+  size_t len; /**< Number of bytes of output that follow */
+} ZygoteRequest;
+
+/**
+ * @brief The answer to a launch request
+ */
+typedef struct ZygoteReply {
+  pid_t pid; /**< The new process or -1 */
+  int err;   /**< errno of the failed launch if pid is -1 */
+} ZygoteReply;
+
+/**
+ * @brief Everything a new process needs, handed to it through clone()
+ */
+typedef struct Launch {
+  pid_t pgid;         /**< Process group to join */
+  int fd_in;          /**< New standard in or -1 */
+  int fd_out;         /**< New standard out or -1 */
+  int gate;           /**< Pipe to wait on before writing or -1 */
+  const char* output; /**< Bytes to write */
+  size_t len;         /**< Number of bytes to write */
+} Launch;
+
+// Quash's end of the socket or -1 if there is no zygote
+static int zygote_fd = -1;
+
+// Signal setup of the processes the zygote starts
+static sigset_t launch_sigmask;
+static sigset_t launch_sigdefault;
+
+static char launch_stack[ZYGOTE_STACK_SIZE] __attribute__ ((aligned (16)));
+
+// Send all len bytes. A zygote or quash that went away is an error, not a
+// SIGPIPE.
+static bool __send_all(int fd, const void* data, size_t len) {
+  const char* next = data;
+
+  while (len > 0) {
+    ssize_t n = send(fd, next, len, MSG_NOSIGNAL);
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    next += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+// Read exactly len bytes. Fails at the end of the stream.
+static bool __read_all(int fd, void* data, size_t len) {
+  char* next = data;
+
+  while (len > 0) {
+    ssize_t n = read(fd, next, len);
+
+    if (n == -1 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    next += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+// Write all len bytes to a descriptor that may be a pipe
+static void __write_all(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+
+      return;
+    }
+
+    data += n;
+    len -= n;
+  }
+}
+
+// Send a request header with its descriptors attached
+static bool __send_request(const ZygoteRequest* req, const int* fds,
+                           int n_fds) {
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = { (void*) req, sizeof(*req) };
+  struct msghdr msg = { 0 };
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (n_fds > 0) {
+    memset(control, 0, sizeof(control));
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+  }
+
+  ssize_t n;
+
+  while ((n = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    ;
+
+  if (n == -1)
+    return false;
+
+  return __send_all(zygote_fd, (const char*) req + n, sizeof(*req) - n);
+}
+
+// Receive a request header and the descriptors attached to it
+static bool __recv_request(int sock, ZygoteRequest* req, int fds[3]) {
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = { req, sizeof(*req) };
+  struct msghdr msg = { 0 };
+  ssize_t n;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+    ;
+
+  if (n <= 0)
+    return false;
+
+  int received[3] = { -1, -1, -1 };
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(received, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+
+  // The rest of a header split by the stream carries no descriptors
+  if (!__read_all(sock, (char*) req + n, sizeof(*req) - n))
+    return false;
+
+  int next = 0;
+
+  fds[0] = (req->fds & ZYGOTE_FD_IN)   ? received[next++] : -1;
+  fds[1] = (req->fds & ZYGOTE_FD_OUT)  ? received[next++] : -1;
+  fds[2] = (req->fds & ZYGOTE_FD_GATE) ? received[next++] : -1;
+
+  return true;
+}
+
+// Body of a process started by the zygote
+static int __launch_main(void* arg) {
+  Launch* launch = arg;
+
+  // Quash moves the process into its job as well, whichever comes first
+  setpgid(0, launch->pgid);
+
+  for (int sig = 1; sig < NSIG; ++sig)
+    if (sigismember(&launch_sigdefault, sig) == 1)
+      signal(sig, SIG_DFL);
+
+  sigprocmask(SIG_SETMASK, &launch_sigmask, NULL);
+
+  if (launch->fd_in != -1) {
+    dup2(launch->fd_in, STDIN_FILENO);
+    close(launch->fd_in);
+  }
+
+  if (launch->fd_out != -1) {
+    dup2(launch->fd_out, STDOUT_FILENO);
+    close(launch->fd_out);
+  }
+
+  // Wait for quash to announce the job, like a copy of quash it forked would
+  if (launch->gate != -1) {
+    char c;
+    ssize_t n;
+
+    while ((n = read(launch->gate, &c, 1)) == -1 && errno == EINTR)
+      ;
+
+    close(launch->gate);
+  }
+
+  __write_all(STDOUT_FILENO, launch->output, launch->len);
+  _exit(0);
+}
+
+// Serve launch requests until quash closes its end of the socket
+static void __zygote_main(int sock) {
+  // Do not keep the directory quash started in busy
+  if (chdir("/") == -1)
+    _exit(-1);
+
+  while (true) {
+    ZygoteRequest req;
+    int fds[3];
+
+    if (!__recv_request(sock, &req, fds))
+      break;
+
+    char* output = malloc(req.len + 1);
+
+    if (output == NULL || !__read_all(sock, output, req.len))
+      break;
+
+    Launch launch = { req.pgid, fds[0], fds[1], fds[2], output, req.len };
+    ZygoteReply reply;
+
+    // CLONE_PARENT makes the process a child of quash, so quash reaps it
+    // and waits for it like for any process it started itself
+    reply.pid = clone(__launch_main, launch_stack + ZYGOTE_STACK_SIZE,
+                      CLONE_PARENT | SIGCHLD, &launch);
+    reply.err = (reply.pid == -1) ? errno : 0;
+
+    for (int i = 0; i < 3; ++i)
+      if (fds[i] != -1)
+        close(fds[i]);
+
+    free(output);
+
+    if (!__send_all(sock, &reply, sizeof(reply)))
+      break;
+  }
+
+  _exit(0);
+}
+
+bool start_zygote(const sigset_t* sigmask, const sigset_t* sigdefault) {
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+    perror("ERROR: Failed to create the zygote socket");
+    return false;
+  }
+
+  launch_sigmask = *sigmask;
+  launch_sigdefault = *sigdefault;
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    perror("ERROR: Failed to start the zygote");
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    close(sv[0]);
+    __zygote_main(sv[1]);
+  }
+
+  close(sv[1]);
+  zygote_fd = sv[0];
+
+  return true;
+}
+
+bool zygote_running() {
+  return zygote_fd != -1;
+}
+
+pid_t zygote_launch(pid_t pgid, int fd_in, int fd_out, int gate,
+                    const char* output, size_t len) {
+  if (zygote_fd == -1)
+    return 0;
+
+  ZygoteRequest req = { pgid, 0, len };
+  ZygoteReply reply;
+  int fds[3];
+  int n_fds = 0;
+
+  if (fd_in != -1) {
+    req.fds |= ZYGOTE_FD_IN;
+    fds[n_fds++] = fd_in;
+  }
+
+  if (fd_out != -1) {
+    req.fds |= ZYGOTE_FD_OUT;
+    fds[n_fds++] = fd_out;
+  }
+
+  if (gate != -1) {
+    req.fds |= ZYGOTE_FD_GATE;
+    fds[n_fds++] = gate;
+  }
+
+  if (!__send_request(&req, fds, n_fds) || !__send_all(zygote_fd, output, len) ||
+      !__read_all(zygote_fd, &reply, sizeof(reply))) {
+    // The zygote is gone. Quash forks by itself from now on.
+    close(zygote_fd);
+    zygote_fd = -1;
+    return 0;
+  }
+
+  if (reply.pid == -1) {
+    errno = reply.err;
+    return -1;
+  }
+
+  return reply.pid;
+}
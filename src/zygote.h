@@ -0,0 +1,78 @@
+/**
+ * @file zygote.h
+ *
+ * @brief A small helper process that starts the processes of builtin commands
+ *
+ * Builtins in a pipeline or in the background need a process of their own, and
+ * forking quash for one costs more the more memory quash holds. The zygote is
+ * forked once, while quash is still small, and forks itself instead. Quash
+ * runs the builtin to produce its output and sends that output to the zygote
+ * over a socket together with the descriptors the new process writes to and
+ * reads from. The zygote starts the process with CLONE_PARENT, so it is a
+ * child of quash that quash waits for and puts in a job like any other.
+ *
+ * Programs are not started here. posix_spawn() already starts them without
+ * copying quash's memory.
+ *
+ * Setting the environment variable `QUASH_NO_ZYGOTE` to anything but the empty
+ * string before quash runs its first command keeps the zygote from starting,
+ * so quash forks itself for every builtin just like it does once the zygote
+ * has failed.
+ */
+
+#ifndef SRC_ZYGOTE_H
+#define SRC_ZYGOTE_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Fork the zygote
+ *
+ * @param sigmask Signal mask the processes it starts run with
+ *
+ * @param sigdefault Signals the processes it starts reset to their default
+ * action
+ *
+ * @return True if the zygote is running
+ */
+bool start_zygote(const sigset_t* sigmask, const sigset_t* sigdefault);
+
+/**
+ * @brief Check whether launches can be handed to the zygote
+ *
+ * @return True if the zygote was started and has not failed since
+ */
+bool zygote_running();
+
+/**
+ * @brief Have the zygote start a process that writes output to its standard out
+ *
+ * The new process joins process group @a pgid, waits until the write end of
+ * @a gate is closed and exits once it has written @a output. Quash should also
+ * move it into @a pgid with setpgid(), so neither order of execution leaves a
+ * gap.
+ *
+ * @param pgid Process group to join or 0 to lead a new one
+ *
+ * @param fd_in Descriptor to use as standard in or -1 to keep quash's
+ *
+ * @param fd_out Descriptor to use as standard out or -1 to keep quash's
+ *
+ * @param gate Read end of a pipe that holds the process back until its write
+ * end is closed or -1 to start right away
+ *
+ * @param output Bytes the process writes
+ *
+ * @param len Number of bytes in @a output
+ *
+ * @return The process id of the new process, -1 with errno set if the zygote
+ * could not start it, or 0 if the zygote is not running. Nothing is started in
+ * the last case and the caller has to fork() itself.
+ */
+pid_t zygote_launch(pid_t pgid, int fd_in, int fd_out, int gate,
+                    const char* output, size_t len);
+
+#endif // SRC_ZYGOTE_H
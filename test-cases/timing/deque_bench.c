@@ -0,0 +1,95 @@
+/**
+ * @file deque_bench.c
+ *
+ * @brief Operations per second of the deques generated by deque.h
+ *
+ * Built by run_timing.bash against the deque.h of a quash tree. Only the
+ * functions every version of the header generates are used, so the same
+ * program compares the current deque with an older one.
+ *
+ * Prints one line for each workload with its name, the number of operations
+ * made and the seconds they took.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "deque.h"
+
+IMPLEMENT_DEQUE_STRUCT(LongDeque, long);
+IMPLEMENT_DEQUE(LongDeque, long);
+
+// Elements a deque holds at most, about as many jobs or commands as quash
+// ever keeps in one
+#define ELEMENTS (64)
+
+static long sum = 0;
+
+static double now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add(long x) {
+  sum += x;
+}
+
+static void report(const char* name, long ops, double start) {
+  printf("%s %ld %.3f\n", name, ops, now() - start);
+}
+
+int main(int argc, char** argv) {
+  long rounds = argc > 1 ? atol(argv[1]) : 2000000;
+  double start;
+
+  // Fill a new deque from the back and empty it from the front, the way the
+  // parser builds the argument and command lists
+  start = now();
+  for (long r = 0; r < rounds; ++r) {
+    LongDeque deq = new_LongDeque(1);
+
+    for (long i = 0; i < ELEMENTS; ++i)
+      push_back_LongDeque(&deq, i);
+
+    while (!is_empty_LongDeque(&deq))
+      sum += pop_front_LongDeque(&deq);
+
+    destroy_LongDeque(&deq);
+  }
+  report("fill", rounds * ELEMENTS * 2, start);
+
+  // Walk a deque by popping every element off the front and pushing it back,
+  // the way the job list is checked
+  LongDeque jobs = new_LongDeque(ELEMENTS);
+
+  for (long i = 0; i < ELEMENTS; ++i)
+    push_back_LongDeque(&jobs, i);
+
+  start = now();
+  for (long r = 0; r < rounds; ++r) {
+    for (long i = 0; i < ELEMENTS; ++i) {
+      long x = pop_front_LongDeque(&jobs);
+
+      sum += x;
+      push_back_LongDeque(&jobs, x);
+    }
+  }
+  report("rotate", rounds * ELEMENTS * 2, start);
+
+  // Walk the same deque with apply
+  start = now();
+  for (long r = 0; r < rounds; ++r)
+    apply_LongDeque(&jobs, add);
+  report("apply", rounds * ELEMENTS, start);
+
+  destroy_LongDeque(&jobs);
+
+  // Printed so the loops are not optimized away
+  fprintf(stderr, "%ld\n", sum);
+
+  return EXIT_SUCCESS;
+}
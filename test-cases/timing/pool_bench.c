@@ -0,0 +1,67 @@
+/**
+ * @file pool_bench.c
+ *
+ * @brief Allocations per second of the parser's memory pool
+ *
+ * Built by run_timing.bash against the memory_pool.c of a quash tree. Only the
+ * functions every version of the pool has are used, so the same program
+ * compares the current pool with an older one.
+ *
+ * Prints the number of allocations made and the seconds they took.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "memory_pool.h"
+
+// Allocations between two resets of the pool, about what a long command line
+// makes while it is parsed
+#define ALLOCS_PER_ROUND (4096)
+
+static double now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+  long rounds = argc > 1 ? atol(argv[1]) : 20000;
+  size_t sizes[ALLOCS_PER_ROUND];
+  unsigned long sum = 0;
+
+  // Mostly short strings with the odd argument array or command structure,
+  // the mix the parser asks for
+  srand(1);
+  for (int i = 0; i < ALLOCS_PER_ROUND; ++i) {
+    if (i % 8 == 7)
+      sizes[i] = sizeof(char*) * (1 + rand() % 16);
+    else
+      sizes[i] = 1 + rand() % 24;
+  }
+
+  double start = now();
+
+  for (long r = 0; r < rounds; ++r) {
+    initialize_memory_pool(1024);
+
+    for (int i = 0; i < ALLOCS_PER_ROUND; ++i) {
+      char* p = memory_pool_alloc(sizes[i]);
+      *p = (char) i;
+      sum += (unsigned long) p & 0xff;
+    }
+
+    destroy_memory_pool();
+  }
+
+  double t = now() - start;
+
+  // Printed so the loop is not optimized away
+  fprintf(stderr, "%lu\n", sum);
+  printf("%ld %.3f\n", rounds * ALLOCS_PER_ROUND, t);
+
+  return EXIT_SUCCESS;
+}
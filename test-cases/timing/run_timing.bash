@@ -0,0 +1,447 @@
+#!/bin/bash
+
+# Rough timings of quash for the performance work on it. These are not tests
+# and are not run by run_tests.bash. Every number is printed for the quash
+# built in this tree and, when a git revision is given, for the quash built
+# from that revision, so a change can be compared with what came before it.
+#
+# Usage: test-cases/timing/run_timing.bash [-r REVISION] [BENCHMARK...]
+#
+# Every benchmark is run when none are named.
+
+cd "$(dirname "$0")/../.."
+
+export TOP_DIR=$PWD
+export TIMING_DIR=$TOP_DIR/test-cases/timing
+
+BENCHMARKS="spawn pipeline script pool string prompt args deque launch"
+
+usage() {
+    printf "Usage: $0 [-r REVISION] [BENCHMARK...]\n" 1>&2
+    printf "\tr - Also time the quash built from a git revision\n" 1>&2
+    printf "Benchmarks: $BENCHMARKS\n" 1>&2
+    exit 1
+}
+
+# Print the current time
+# RETURN: Seconds since the epoch
+now() {
+    date +%s.%N
+}
+
+# Print the time passed since a timestamp taken with now
+# RETURN: Elapsed seconds
+since() {
+    # $1 - Timestamp printed by now
+
+    awk -v s="$1" -v e="$(now)" 'BEGIN { printf "%.3f", e - s }'
+}
+
+# Print a rate of things per second
+# RETURN: Rate rounded to a whole number
+rate() {
+    # $1 - Number of things done
+    # $2 - Seconds it took
+
+    awk -v n="$1" -v t="$2" 'BEGIN { printf "%.0f", (t > 0 ? n / t : 0) }'
+}
+
+# Print one line of results for a quash build
+report() {
+    # $1 - Name of the build
+    # $2... - Result
+
+    local name="$1"
+    shift
+
+    printf "  %-10s %s\n" "$name" "$*"
+}
+
+# Build the quash of a git revision in a scratch work tree
+build_revision() {
+    # $1 - Revision to build
+
+    BASE_DIR=$WORK_DIR/base
+
+    git worktree add -f --detach "$BASE_DIR" "$1" > /dev/null || exit 1
+
+    # The generated parser, and the scanner of older revisions, are committed.
+    # Make sure they are not regenerated and that nothing committed under obj/
+    # is reused. Revisions without a committed scanner need flex to build.
+    (cd "$BASE_DIR" &&
+         rm -f quash obj/*.o obj/parsing/*.o &&
+         touch -c src/parsing/lex.yy.c src/parsing/parse.tab.c \
+               src/parsing/parse.tab.h &&
+         make > /dev/null 2>&1) || {
+        echo "ERROR: Failed to build $1" 1>&2
+        exit 1
+    }
+}
+
+# Compile one of the C microbenchmarks against the sources of a build
+# RETURN: Path of the program or nothing if it failed to compile
+compile_bench() {
+    # $1 - Source of the benchmark in the timing directory
+    # $2 - Top directory of the build
+    # $3... - Sources of the build to link in, relative to its src directory
+
+    local src=$TIMING_DIR/$1
+    local dir=$2
+    shift 2
+
+    local exe=$(mktemp -p "$WORK_DIR")
+
+    gcc --std=gnu11 -O2 -I "$dir/src" -I "$dir/src/parsing" -o "$exe" \
+        "$src" "${@/#/$dir/src/}" > /dev/null 2>&1 && echo "$exe"
+}
+
+# Run a benchmark against this tree and against the revision
+run_benchmark() {
+    # $1 - Benchmark to run
+
+    echo "$1:"
+
+    bench_$1 "this tree" "$TOP_DIR"
+
+    if [ -n "$BASE_DIR" ]; then
+        bench_$1 "$REVISION" "$BASE_DIR"
+    fi
+}
+
+###############################################################################
+# Benchmarks. Each is called with the name of a build and its top directory.
+###############################################################################
+
+# Commands started per second from a script of short lived programs
+bench_spawn() {
+    local n=2000
+    local script=$WORK_DIR/spawn.txt
+
+    for i in $(seq $n); do
+        echo "/bin/true"
+    done > "$script"
+
+    local start=$(now)
+    "$2/quash" < "$script" > /dev/null 2>&1
+    local t=$(since $start)
+
+    report "$1" "$n commands in ${t}s, $(rate $n $t) commands/s"
+}
+
+# Data pushed through a pipeline of ten stages. Set PIPELINE_MB to change how
+# much.
+bench_pipeline() {
+    local mb=${PIPELINE_MB:-2048}
+    local line="head -c ${mb}M /dev/zero"
+
+    for i in $(seq 8); do
+        line="$line | cat"
+    done
+
+    local start=$(now)
+    local out=$(echo "$line | wc -c" | timeout 300 "$2/quash" 2> /dev/null)
+    local t=$(since $start)
+
+    if [ "$out" != "$((mb * 1048576))" ]; then
+        report "$1" "failed after ${t}s, wc counted '$out' bytes"
+    else
+        report "$1" "$mb MiB in ${t}s, $(rate $mb $t) MiB/s"
+    fi
+}
+
+# Lines run per second from a large script of builtins that start no process,
+# read from standard in and with -f. The second -f run loads the script from
+# the cache the first one filled. Set SCRIPT_LINES to change the length.
+bench_script() {
+    local n=${SCRIPT_LINES:-100000}
+    local script=$WORK_DIR/script.txt
+
+    for i in $(seq $n); do
+        echo "export TIMING_VAR=$i"
+    done > "$script"
+    echo 'echo $TIMING_VAR' >> "$script"
+
+    local start=$(now)
+    local out=$("$2/quash" < "$script" 2> /dev/null)
+    local t=$(since $start)
+
+    report "$1" "$(printf "%-10s" stdin) $n lines in ${t}s, $(rate $n $t) lines/s"
+
+    if [ "$out" != "$n" ]; then
+        report "" "$(printf "%-10s" stdin) wrong output '$out'"
+    fi
+
+    local mode
+    for mode in "-f first" "-f cached"; do
+        start=$(now)
+        out=$(XDG_CACHE_HOME=$WORK_DIR/cache timeout 60 "$2/quash" \
+                  -f "$script" < /dev/null 2> /dev/null)
+        t=$(since $start)
+
+        if [ "$out" != "$n" ]; then
+            report "" "$(printf "%-10s" -f) not supported"
+            break
+        fi
+
+        report "" "$(printf "%-10s" "$mode") $n lines in ${t}s, $(rate $n $t) lines/s"
+    done
+
+    rm -rf "$WORK_DIR/cache"
+}
+
+# Allocations per second from the memory pool, in the sizes the parser asks
+# for. Set POOL_ROUNDS to change how many rounds of 4096 allocations are made.
+bench_pool() {
+    local exe=$(compile_bench pool_bench.c "$2" parsing/memory_pool.c)
+
+    if [ -z "$exe" ]; then
+        report "$1" "failed to compile"
+        return
+    fi
+
+    local res=($("$exe" ${POOL_ROUNDS:-20000} 2> /dev/null))
+
+    report "$1" "${res[0]} allocations in ${res[1]}s," \
+           "$(rate ${res[0]} ${res[1]}) allocations/s"
+}
+
+# Argument bytes interpreted per second for echo lines of a single argument of
+# 16 B to 1 MiB, either plain or with an escape every 16 bytes. Set STRING_MB
+# to change how much is echoed for each size.
+bench_string() {
+    local total=$((${STRING_MB:-16} * 1048576))
+    local script=$WORK_DIR/string.txt
+    local name=$1
+    local kind size
+
+    for kind in plain escaped; do
+        for size in 16 256 4096 65536 1048576; do
+            local n=$((total / size))
+            local word out_size
+
+            if [ $n -gt 2000 ]; then
+                n=2000
+            elif [ $n -lt 1 ]; then
+                n=1
+            fi
+
+            # Each "\ " in an escaped word is echoed as a single space
+            if [ $kind = plain ]; then
+                word=$(head -c $size /dev/zero | tr '\0' a)
+                out_size=$size
+            else
+                word=$(yes 'aaaaaaaaaaaaaa\ ' | tr -d '\n' | head -c $size)
+                out_size=$((size - size / 16))
+            fi
+
+            for i in $(seq $n); do
+                echo "echo $word"
+            done > "$script"
+
+            local start=$(now)
+            local out=$(timeout 300 "$2/quash" < "$script" 2> /dev/null | wc -c)
+            local t=$(since $start)
+            local label=$(printf "%-7s %7s" $kind ${size}B)
+
+            if [ "$out" != "$((n * (out_size + 1)))" ]; then
+                report "$name" "$label failed, echoed $out bytes"
+            else
+                report "$name" "$label $n lines in ${t}s," \
+                       "$(rate $((n * size / 1024)) $t) KiB/s"
+            fi
+
+            name=""
+        done
+    done
+}
+
+# Time from one prompt to the next when empty lines are typed into quash on a
+# terminal. Quash runs date before and after the empty lines, so starting quash
+# and the terminal are left out. Set PROMPT_LINES to change how many lines are
+# typed.
+bench_prompt() {
+    local n=${PROMPT_LINES:-100000}
+    local script=$WORK_DIR/prompt.txt
+    local out=$WORK_DIR/prompt.out
+
+    (echo "date +%s%N"; yes '' | head -n $n; echo "date +%s%N"; echo exit) \
+        > "$script"
+
+    # Script stalls for seconds when its input ends before quash has read all
+    # of it, so the input is held open until quash has printed both times or
+    # the output is removed
+    : > "$out"
+
+    timeout 300 script -qefc "$2/quash" /dev/null > "$out" < <(
+        cat "$script"
+
+        while [ -e "$out" ] &&
+                  [ "$(grep -c '[0-9]\{19\}' "$out")" -lt 2 ]; do
+            sleep 0.1
+        done 2> /dev/null)
+
+    sed -i 's/\r//g' "$out"
+
+    local prompts=$(grep -o '\]\$ ' "$out" | wc -l)
+    local stamps=($(grep -o '[0-9]\{19\}$' "$out"))
+
+    if [ "$prompts" != "$((n + 3))" ] || [ ${#stamps[@]} != 2 ]; then
+        report "$1" "failed, printed $prompts prompts"
+        return
+    fi
+
+    local t=$(awk -v s=${stamps[0]} -v e=${stamps[1]} \
+                  'BEGIN { printf "%.3f", (e - s) / 1e9 }')
+
+    report "$1" "$n prompts in ${t}s," \
+           "$(awk -v n=$n -v t=$t 'BEGIN { printf "%.1f", t * 1e6 / n }') us" \
+           "per prompt"
+}
+
+# Arguments parsed per second for echo lines of 10^3 to 10^6 arguments. Each
+# size echoes a million arguments in all.
+bench_args() {
+    local script=$WORK_DIR/args.txt
+    local name=$1
+    local size
+
+    for size in 1000 10000 100000 1000000; do
+        local n=$((1000000 / size))
+        local line="echo$(yes ' a' | head -n $size | tr -d '\n')"
+
+        for i in $(seq $n); do
+            echo "$line"
+        done > "$script"
+
+        local start=$(now)
+        local out=$(timeout 300 "$2/quash" < "$script" 2> /dev/null | wc -c)
+        local t=$(since $start)
+        local label=$(printf "%7s args" $size)
+
+        if [ "$out" != "$((n * size * 2))" ]; then
+            report "$name" "$label failed, echoed $out bytes"
+        else
+            report "$name" "$label $n lines in ${t}s," \
+                   "$(rate 1000000 $t) args/s"
+        fi
+
+        name=""
+    done
+}
+
+# Deque operations per second when filling and emptying a deque, rotating one
+# and walking one with apply. Set DEQUE_ROUNDS to change how many rounds over
+# 64 elements are made.
+bench_deque() {
+    local exe=$(compile_bench deque_bench.c "$2")
+
+    if [ -z "$exe" ]; then
+        report "$1" "failed to compile"
+        return
+    fi
+
+    local name=$1
+    local work ops t
+
+    while read work ops t; do
+        report "$name" "$(printf "%-7s" $work) $ops operations in ${t}s," \
+               "$(rate $ops $t) operations/s"
+        name=""
+    done < <("$exe" ${DEQUE_ROUNDS:-2000000} 2> /dev/null)
+}
+
+# Time to start the process of a builtin in a pipeline, with quash at its
+# starting size and after a long word has grown its heap, through the zygote
+# and with QUASH_NO_ZYGOTE set so quash forks itself. A revision without the
+# zygote forks both times. Quash runs date before and after the launches, so
+# the word is not timed. Set LAUNCH_LINES to change how many pipelines of two
+# builtins are run and HEAP_MB to change the word.
+bench_launch() {
+    local n=${LAUNCH_LINES:-1000}
+    local mb=${HEAP_MB:-64}
+    local script=$WORK_DIR/launch.txt
+    local name=$1
+    local heap mode
+
+    for heap in small large; do
+        for mode in zygote fork; do
+            (if [ $heap = large ]; then
+                 echo "echo $(head -c ${mb}M /dev/zero | tr '\0' a) > /dev/null"
+             fi
+
+             echo "date +%s%N"
+             yes "echo x | echo y" | head -n $n
+             echo "date +%s%N"
+             echo "bash -c 'grep VmRSS /proc/\$PPID/status'") > "$script"
+
+            local no_zygote=$([ $mode = fork ] && echo 1)
+            local out=$(QUASH_NO_ZYGOTE=$no_zygote timeout 120 "$2/quash" \
+                            < "$script" 2> /dev/null)
+            local stamps=($(echo "$out" | grep -x '[0-9]\{19\}'))
+            local rss=$(echo "$out" | awk '/^VmRSS:/ { print $2 / 1024 }')
+            local label=$(printf "%-6s %-5s" $mode $heap)
+
+            if [ "$(echo "$out" | grep -cx y)" != $n ] ||
+                   [ ${#stamps[@]} != 2 ]; then
+                report "$name" "$label failed"
+            else
+                local t=$(awk -v s=${stamps[0]} -v e=${stamps[1]} \
+                              'BEGIN { printf "%.3f", (e - s) / 1e9 }')
+                local us=$(awk -v n=$n -v t=$t \
+                               'BEGIN { printf "%.1f", t * 1e6 / (2 * n) }')
+
+                report "$name" "$label $((2 * n)) launches in ${t}s," \
+                       "$us us per launch, ${rss%.*} MiB resident"
+            fi
+
+            name=""
+        done
+    done
+}
+
+###############################################################################
+# Main
+###############################################################################
+
+while getopts "r:h" opt; do
+    case $opt in
+        r)
+            REVISION=$OPTARG
+            ;;
+        *)
+            usage
+            ;;
+    esac
+done
+
+shift $((OPTIND - 1))
+
+if [ $# -gt 0 ]; then
+    BENCHMARKS="$*"
+fi
+
+make > /dev/null || exit 1
+
+WORK_DIR=$(mktemp -d)
+
+cleanup() {
+    if [ -n "$BASE_DIR" ]; then
+        git worktree remove -f "$BASE_DIR"
+    fi
+
+    rm -rf "$WORK_DIR"
+}
+
+trap cleanup EXIT
+
+if [ -n "$REVISION" ]; then
+    build_revision "$REVISION"
+fi
+
+for B in $BENCHMARKS; do
+    if [ "$(type -t bench_$B)" != "function" ]; then
+        usage
+    fi
+
+    run_benchmark $B
+done